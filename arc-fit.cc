@@ -0,0 +1,131 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "arc-fit.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+namespace {
+// Fewer segments than that are not worth an arc.
+const int kMinArcSegments = 3;
+
+// Very small arcs suffer from the rounding of the output, very large are
+// essentially lines and numerically unstable.
+const double kMinRadius = 0.2;
+const double kMaxRadius = 1000.0;
+
+class ArcFitter {
+public:
+  ArcFitter(const double *x, const double *y, const double *z,
+            double tolerance)
+    : x_(x), y_(y), z_(z), tolerance_(tolerance) {}
+
+  // Check if the points from "start" to "end" lie on an arc. If so, fill
+  // "arc" and return true.
+  bool Fits(int start, int end, Arc *arc) {
+    // Circle through start, middle and end point.
+    const int mid = (start + end) / 2;
+    const double ax = x_[mid] - x_[start], ay = y_[mid] - y_[start];
+    const double bx = x_[end] - x_[start], by = y_[end] - y_[start];
+    const double d = 2 * (ax * by - ay * bx);
+    const double a_sq = ax * ax + ay * ay;
+    const double b_sq = bx * bx + by * by;
+    if (fabs(d) < 1e-12)
+      return false;   // Straight line.
+    const double cx = (by * a_sq - ay * b_sq) / d;
+    const double cy = (ax * b_sq - bx * a_sq) / d;
+    const double radius = sqrt(cx * cx + cy * cy);
+    if (radius < kMinRadius || radius > kMaxRadius)
+      return false;
+    const Vector2D center(x_[start] + cx, y_[start] + cy);
+    const bool clockwise = d < 0;
+
+    // All points need to be on the circle and go around in the same
+    // direction; the segments between them must not be too far from it.
+    angle_.resize(end - start + 1);
+    angle_[0] = 0;
+    double sweep = 0;
+    for (int i = start + 1; i <= end; ++i) {
+      const double px = x_[i-1] - center.x, py = y_[i-1] - center.y;
+      const double qx = x_[i] - center.x, qy = y_[i] - center.y;
+      if (fabs(distance(qx, qy, 0) - radius) > tolerance_)
+        return false;
+      const double half_chord = distance(qx - px, qy - py, 0) / 2;
+      if (half_chord >= radius
+          || radius - sqrt(radius*radius - half_chord*half_chord) > tolerance_)
+        return false;
+      double step = atan2(px * qy - py * qx, px * qx + py * qy);
+      if (clockwise) step = -step;
+      if (step <= 0)
+        return false;
+      sweep += step;
+      angle_[i - start] = sweep;
+    }
+    if (sweep > 2 * M_PI - 0.1)
+      return false;  // Don't go full circle, that would be ambiguous.
+
+    // Firmware interpolates z linearly with the angle.
+    const double z_range = z_[end] - z_[start];
+    for (int i = start + 1; i < end; ++i) {
+      const double expected = z_[start] + z_range * angle_[i - start] / sweep;
+      if (fabs(z_[i] - expected) > tolerance_)
+        return false;
+    }
+
+    arc->start = start;
+    arc->end = end;
+    arc->center = center;
+    arc->clockwise = clockwise;
+    return true;
+  }
+
+private:
+  const double *const x_;
+  const double *const y_;
+  const double *const z_;
+  const double tolerance_;
+  std::vector<double> angle_;   // Angle of each point from start.
+};
+}  // namespace
+
+std::vector<Arc> FitArcs(const double *x, const double *y, const double *z,
+                         int count, double tolerance) {
+  std::vector<Arc> result;
+  ArcFitter fitter(x, y, z, tolerance);
+  Arc arc;
+  int start = 0;
+  while (start + kMinArcSegments < count) {
+    if (!fitter.Fits(start, start + kMinArcSegments, &arc)) {
+      ++start;
+      continue;
+    }
+    // Find the longest arc from here: double the length while it fits,
+    // then binary search between the last good and first bad length.
+    int good = kMinArcSegments;
+    int bad = -1;
+    const int max_len = count - 1 - start;
+    while (good < max_len) {
+      const int len = std::min(2 * good, max_len);
+      if (!fitter.Fits(start, start + len, &arc)) {
+        bad = len;
+        break;
+      }
+      good = len;
+    }
+    while (bad > 0 && bad - good > 1) {
+      const int len = (good + bad) / 2;
+      if (fitter.Fits(start, start + len, &arc))
+        good = len;
+      else
+        bad = len;
+    }
+    fitter.Fits(start, start + good, &arc);
+    result.push_back(arc);
+    start += good;
+  }
+  return result;
+}
@@ -0,0 +1,32 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_ARC_FIT_H_
+#define SHELL_EXTRUDE_ARC_FIT_H_
+
+#include <vector>
+
+#include "multi-shell-extrude.h"
+
+// A run of path points that lies on a circular (helical, if z changes) arc.
+// The arc starts at point "start" and goes through all following points up to
+// and including point "end".
+struct Arc {
+  int start;
+  int end;
+  Vector2D center;
+  bool clockwise;
+};
+
+// Find arcs in the path given by "count" points in the "x", "y", "z" arrays.
+// Each point between start and end of an arc, as well as each segment in
+// between, is not further away than "tolerance" from the arc. The z-value
+// is expected to change linearly with the angle, as is the case for helical
+// moves in printer firmware.
+// Arcs are sorted and don't overlap, but the end of one arc can be the
+// start of the next.
+std::vector<Arc> FitArcs(const double *x, const double *y, const double *z,
+                         int count, double tolerance);
+
+#endif  // SHELL_EXTRUDE_ARC_FIT_H_
@@ -0,0 +1,91 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "background-writer.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+BackgroundWriter::BackgroundWriter(int fd, size_t buffer_size,
+                                   int buffer_count)
+  : fd_(fd), buffer_size_(buffer_size), buffer_count_(buffer_count),
+    slots_(new Slot[buffer_count]), submitted_(0), written_(0),
+    finished_(false), bytes_written_(0), error_(0) {
+  for (int i = 0; i < buffer_count_; ++i) {
+    slots_[i].data = new char[buffer_size_];
+    slots_[i].len = 0;
+  }
+  thread_ = std::thread(&BackgroundWriter::Run, this);
+}
+
+BackgroundWriter::~BackgroundWriter() {
+  Finish();
+  for (int i = 0; i < buffer_count_; ++i) {
+    delete [] slots_[i].data;
+  }
+  delete [] slots_;
+}
+
+char *BackgroundWriter::GetBuffer() {
+  std::unique_lock<std::mutex> l(mutex_);
+  buffer_free_.wait(l, [&]() {
+      return submitted_ - written_ < (uint64_t) buffer_count_;
+    });
+  return slots_[submitted_ % buffer_count_].data;
+}
+
+void BackgroundWriter::Submit(size_t len) {
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    slots_[submitted_ % buffer_count_].len = len;
+    ++submitted_;
+  }
+  data_ready_.notify_one();
+}
+
+void BackgroundWriter::Finish() {
+  if (!thread_.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    finished_ = true;
+  }
+  data_ready_.notify_one();
+  thread_.join();
+}
+
+void BackgroundWriter::Run() {
+  uint64_t next = 0;
+  for (;;) {
+    size_t slot_len;
+    {
+      std::unique_lock<std::mutex> l(mutex_);
+      data_ready_.wait(l, [&]() { return submitted_ > next || finished_; });
+      if (submitted_ == next)
+        return;   // finished and nothing left.
+      slot_len = slots_[next % buffer_count_].len;
+    }
+    const char *data = slots_[next % buffer_count_].data;
+    // After a failure, buffers are still taken so that the producer does
+    // not wait forever, but not written: the output would have a gap.
+    size_t len = (error_ == 0) ? slot_len : 0;
+    while (len > 0) {
+      const ssize_t w = write(fd_, data, len);
+      if (w < 0) {
+        if (errno == EINTR) continue;
+        error_ = errno;
+        break;
+      }
+      data += w;
+      len -= w;
+      bytes_written_ += w;
+    }
+    {
+      std::lock_guard<std::mutex> l(mutex_);
+      written_ = ++next;
+    }
+    buffer_free_.notify_one();
+  }
+}
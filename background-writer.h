@@ -0,0 +1,80 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_BACKGROUND_WRITER_H_
+#define SHELL_EXTRUDE_BACKGROUND_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Writes buffers to a file descriptor in a background thread, so that
+// generating output and writing it to a slow pipe or disk overlap.
+//
+// There is a fixed ring of large buffers. The producer fills one at a time
+// and submits it; the writer thread writes submitted buffers in order and
+// returns them to the ring. Single producer, single consumer; either side
+// only waits if the ring is completely full or empty.
+// The ring is not lock-free: handing over a multi-megabyte buffer is rare,
+// so a mutex and condition variables to wait on cost nothing measurable
+// and don't burn a CPU spinning while the disk is slow.
+class BackgroundWriter {
+public:
+  BackgroundWriter(int fd, size_t buffer_size = (4 << 20),
+                   int buffer_count = 4);
+  ~BackgroundWriter();  // Finish()es; does not close the file descriptor.
+
+  size_t buffer_size() const { return buffer_size_; }
+
+  // Get next buffer to fill. Waits if all buffers are waiting to be written.
+  char *GetBuffer();
+
+  // Submit the buffer last returned by GetBuffer() with "len" bytes to write.
+  void Submit(size_t len);
+
+  // Wait until all submitted buffers are written and stop writer thread.
+  void Finish();
+
+  // Number of bytes written. Read after Finish().
+  int64_t bytes_written() const { return bytes_written_; }
+
+  // errno of the first failed write, 0 if all went well. Writing stops at
+  // the first failure. Read after Finish().
+  int error() const { return error_; }
+
+private:
+  BackgroundWriter(const BackgroundWriter &);   // Not copyable.
+  void operator=(const BackgroundWriter &);
+
+  struct Slot {
+    char *data;
+    size_t len;
+  };
+
+  void Run();
+
+  const int fd_;
+  const size_t buffer_size_;
+  const int buffer_count_;
+  Slot *const slots_;
+
+  // Monotonically increasing counters; slot index is counter % buffer_count.
+  // Only accessed with mutex_ held.
+  std::mutex mutex_;
+  std::condition_variable buffer_free_;   // written_ increased.
+  std::condition_variable data_ready_;    // submitted_ or finished_ changed.
+  uint64_t submitted_;  // Written by producer.
+  uint64_t written_;    // Written by writer thread.
+  bool finished_;
+
+  // Only written by writer thread.
+  int64_t bytes_written_;
+  int error_;
+  std::thread thread_;
+};
+
+#endif  // SHELL_EXTRUDE_BACKGROUND_WRITER_H_
@@ -0,0 +1,93 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "bed-layout.h"
+
+#include <algorithm>
+
+namespace {
+// Small slack for rounding, so that boxes exactly the clearance apart fit.
+const double kEpsilon = 1e-6;
+
+// Check if the print head, while printing "box", stays clear of "other".
+bool Clear(const Box &box, const Box &other, const BedConstraints &c) {
+  const double gap_x = std::max(box.min.x - other.max.x,
+                                other.min.x - box.max.x);
+  const double gap_y = std::max(box.min.y - other.max.y,
+                                other.min.y - box.max.y);
+  if (c.gantry_collides)
+    return gap_y >= c.head_clearance.y - kEpsilon;
+  return (gap_x >= c.head_clearance.x - kEpsilon
+          || gap_y >= c.head_clearance.y - kEpsilon);
+}
+
+Box Translate(const Box &box, const Vector2D &offset) {
+  Box result = { box.min + offset, box.max + offset };
+  return result;
+}
+}  // namespace
+
+int PlaceOnBed(const std::vector<Box> &footprint,
+               const BedConstraints &constraints,
+               std::vector<Vector2D> *centers) {
+  const Box &bed = constraints.bed;
+  const Vector2D &clearance = constraints.head_clearance;
+  std::vector<Box> placed;
+  centers->clear();
+  for (const Box &object : footprint) {
+    // Candidate positions for the lower left corner of the object: the bed
+    // corner, or aligned to an already placed box or its clearance.
+    std::vector<double> xs = { bed.min.x };
+    std::vector<double> ys = { bed.min.y };
+    for (const Box &other : placed) {
+      xs.push_back(other.min.x);
+      xs.push_back(other.max.x + clearance.x);
+      ys.push_back(other.min.y);
+      ys.push_back(other.max.y + clearance.y);
+    }
+    const Vector2D size = object.max - object.min;
+    bool found = false;
+    Vector2D best;
+    for (double y : ys) {
+      for (double x : xs) {
+        if (found && (y > best.y || (y == best.y && x >= best.x)))
+          continue;   // We look for the bottom-most, then left-most.
+        if (x < bed.min.x || y < bed.min.y
+            || x + size.x > bed.max.x + kEpsilon
+            || y + size.y > bed.max.y + kEpsilon)
+          continue;
+        const Box candidate = { Vector2D(x, y), Vector2D(x, y) + size };
+        bool is_clear = true;
+        for (size_t i = 0; is_clear && i < placed.size(); ++i) {
+          is_clear = Clear(candidate, placed[i], constraints);
+        }
+        if (is_clear) {
+          best = Vector2D(x, y);
+          found = true;
+        }
+      }
+    }
+    if (!found)
+      break;
+    centers->push_back(best - object.min);
+    placed.push_back(Translate(object, best - object.min));
+  }
+  if (placed.empty())
+    return 0;
+
+  // Center the whole layout on the bed.
+  Box used = placed[0];
+  for (const Box &box : placed) {
+    used.min = Vector2D(std::min(used.min.x, box.min.x),
+                        std::min(used.min.y, box.min.y));
+    used.max = Vector2D(std::max(used.max.x, box.max.x),
+                        std::max(used.max.y, box.max.y));
+  }
+  const Vector2D shift = ((bed.max - used.max) - (used.min - bed.min)) / 2;
+  for (Vector2D &center : *centers) {
+    center = center + shift;
+  }
+  return placed.size();
+}
@@ -0,0 +1,40 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_BED_LAYOUT_H_
+#define SHELL_EXTRUDE_BED_LAYOUT_H_
+
+#include <vector>
+
+#include "multi-shell-extrude.h"
+
+// Axis aligned rectangle.
+struct Box {
+  Vector2D min, max;
+};
+
+// What limits the placement of objects that are printed one after another.
+struct BedConstraints {
+  Box bed;                   // Area objects need to be in.
+  Vector2D head_clearance;   // Space the print head needs around the nozzle.
+  // If true, the gantry (along x) is lower than the objects, so it would hit
+  // an object printed earlier in the same y-range.
+  bool gantry_collides;
+};
+
+// Place objects with the given "footprint" (relative to their center) on
+// the bed, in that order. The print head, while printing an object, must not
+// touch any object printed earlier. The head is modelled as a rectangle of
+// "head_clearance" around the nozzle; with "gantry_collides", the
+// objects need to be separated in y.
+// With these constraints, the order in which objects are printed does not
+// matter, so they can be printed in the given order.
+// Objects are placed bottom-left first, then the layout is centered on the
+// bed. Returns the number of objects that fit; their centers are stored in
+// "centers".
+int PlaceOnBed(const std::vector<Box> &footprint,
+               const BedConstraints &constraints,
+               std::vector<Vector2D> *centers);
+
+#endif  // SHELL_EXTRUDE_BED_LAYOUT_H_
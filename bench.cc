@@ -0,0 +1,345 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+// Benchmark of the stages of creating a screw, and of the whole pipeline,
+// to compare the performance before and after a change.
+//
+// Inputs are the polygons in the sample directory, dense screw templates and
+// Moore curves (closed Hilbert curves) with 10^4 to 10^6 vertices. Each
+// measurement is printed as one line of JSON on stdout:
+//
+//   {"label":"...","stage":"extrusion","input":"moore-16384",...}
+//
+// Times are the fastest of repeated runs for at least --min-time seconds.
+
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "multi-shell-extrude.h"
+#include "background-writer.h"
+#include "config-values.h"
+#include "extrusion.h"
+#include "motion-planner.h"
+#include "output-buffer.h"
+#include "printer.h"
+
+namespace {
+struct Input {
+  std::string name;
+  Polygon polygon;
+  double offset;   // Offset between shells.
+};
+
+// What one measurement processed; zero if not applicable.
+struct Work {
+  int64_t vertices;
+  int64_t layers;
+  int64_t bytes;
+};
+
+// Moves the polygon so that its centroid is on (0,0), as the extrusion
+// requires.
+Polygon Centered(const Polygon &polygon) {
+  const FixedPoint c = ToFixed(Centroid(polygon));
+  Polygon result;
+  for (const FixedPoint &p : polygon) {
+    result.push_back(FixedPoint(p.x - c.x, p.y - c.y));
+  }
+  return result;
+}
+
+// Moore curve, the closed variant of the Hilbert curve, as turtle graphics
+// of the L-system L -> -RF+LFL+FR-, R -> +LF-RFR-FL+.
+class MooreCurve {
+public:
+  MooreCurve(double step) : step_(step), dx_(0), dy_(1) {}
+
+  // Curve with 4^(depth+1) vertices on a grid with the given step.
+  Polygon Create(int depth) {
+    result_.clear();
+    pos_ = Vector2D(0, 0);
+    result_.push_back(ToFixed(pos_));
+    Expand("LFL+F+LFL", depth);
+    return Centered(result_);
+  }
+
+private:
+  void Expand(const char *rule, int depth) {
+    for (const char *c = rule; *c; ++c) {
+      switch (*c) {
+      case 'L': if (depth > 0) Expand("-RF+LFL+FR-", depth - 1); break;
+      case 'R': if (depth > 0) Expand("+LF-RFR-FL+", depth - 1); break;
+      case '+': Turn(1); break;
+      case '-': Turn(-1); break;
+      case 'F':
+        pos_ = pos_ + Vector2D(dx_, dy_) * step_;
+        result_.push_back(ToFixed(pos_));
+        break;
+      }
+    }
+  }
+  void Turn(int direction) {
+    const int dx = dx_;
+    dx_ = -direction * dy_;
+    dy_ = direction * dx;
+  }
+
+  const double step_;
+  int dx_, dy_;
+  Vector2D pos_;
+  Polygon result_;
+};
+
+double Now() {
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Run "fun" repeatedly for at least "min_time" seconds and return the time
+// of the fastest run. "fun" gets the number of the run.
+double Measure(double min_time, const std::function<void(int)> &fun) {
+  const double start = Now();
+  double best = -1;
+  for (int run = 0; run == 0 || Now() - start < min_time; ++run) {
+    const double run_start = Now();
+    fun(run);
+    const double t = Now() - run_start;
+    if (best < 0 || t < best) best = t;
+  }
+  return best;
+}
+
+void Report(const std::string &label, const char *stage,
+            const std::string &input, const Work &work, double seconds) {
+  printf("{\"label\":\"%s\",\"stage\":\"%s\",\"input\":\"%s\","
+         "\"seconds\":%.6f", label.c_str(), stage, input.c_str(), seconds);
+  if (work.vertices > 0) {
+    printf(",\"vertices\":%lld,\"vertices_per_sec\":%.0f",
+           (long long)work.vertices, work.vertices / seconds);
+  }
+  if (work.layers > 0) {
+    printf(",\"layers\":%lld,\"layers_per_sec\":%.1f",
+           (long long)work.layers, work.layers / seconds);
+  }
+  if (work.bytes > 0) {
+    printf(",\"output_mb\":%.2f,\"output_mb_per_sec\":%.1f",
+           work.bytes / 1e6, work.bytes / 1e6 / seconds);
+  }
+  printf("}\n");
+  fflush(stdout);
+}
+
+// Settings as in a default multi-shell-extrude invocation.
+const MotionLimits kMotionLimits = { 1000, 10, 0, 16 };
+const double kLayerHeight = 0.16;
+const double kExtrusionFactor = 0.0266;
+
+ExtrusionParams DefaultExtrusion(double total_height) {
+  ExtrusionParams params;
+  params.feedrate = 100;
+  params.layer_height = kLayerHeight;
+  params.total_height = total_height;
+  params.rotation_per_mm = 1.0 / 30;
+  params.lock_offset = -1;
+  params.fan_on_height = 0.3;
+  params.elephant_foot_multiplier = 0.9;
+  params.first_layer_feedrate_multiplier = 0.7;
+  params.arc_tolerance = 0;
+  params.max_segment_rate = 0;
+  params.decimate_tolerance = 0.02;
+  params.plan_feedrate = true;
+  params.max_feedrate = 100;
+  params.min_layer_time = 3;
+  params.motion_limits = kMotionLimits;
+  params.base_temp = 190;
+  params.temp_variation = 0;
+  return params;
+}
+
+// Number of layers to extrude for a polygon, so that runs don't take
+// forever for large polygons.
+int LayersFor(const Polygon &polygon) {
+  return std::max(8, std::min(200, (int)(2e6 / polygon.size())));
+}
+
+// Extrude each of the "polygons" as screw of "layers" into /dev/null, the
+// way multi-shell-extrude does. Returns the work done.
+Work ExtrudeScrews(const std::vector<Polygon> &polygons, int layers,
+                   bool binary) {
+  const int fd = open("/dev/null", O_WRONLY);
+  BackgroundWriter writer(fd);
+  OutputBuffer *out = new OutputBuffer(&writer);
+  Printer *printer = binary
+    ? CreateBinaryGCodePrinter(out, kExtrusionFactor, 1.2, 190, -1, 0,
+                               kMotionLimits)
+    : CreateGCodePrinter(out, kExtrusionFactor, 1.2, 190, -1, 0,
+                         kMotionLimits);
+  const Vector2D bed(150, 150);
+  printer->Preamble(bed, 100);
+  printer->Init(bed, 100);
+  Work work = { 0, 0, 0 };
+  for (const Polygon &polygon : polygons) {
+    if (polygon.empty()) continue;
+    std::vector<float> layer_time;
+    printer->ResetExtrude();
+    CreateExtrusion(polygon, printer, bed / 2,
+                    DefaultExtrusion(layers * kLayerHeight), &layer_time);
+    printer->Retract();
+    work.vertices += polygon.size() * layer_time.size();
+    work.layers += layer_time.size();
+  }
+  printer->Postamble();
+  delete printer;
+  writer.Finish();
+  close(fd);
+  work.bytes = writer.bytes_written();
+  return work;
+}
+
+void Benchmark(const Input &input, double min_time, bool with_offsets,
+               const std::string &label) {
+  const Polygon &polygon = input.polygon;
+  const int64_t vertices = polygon.size();
+
+  // Distinct offsets in each run, so that we don't measure the cache.
+  if (with_offsets) {
+    const Work offset_work = { vertices, 0, 0 };
+    Report(label, "polygon-offset", input.name, offset_work,
+           Measure(min_time, [&](int run) {
+               PolygonOffset(polygon, input.offset * (1 + run * 1e-4));
+             }));
+  }
+
+  const int layers = LayersFor(polygon);
+  for (const bool binary : { false, true }) {
+    Work work;
+    const double t = Measure(min_time, [&](int) {
+        work = ExtrudeScrews({ polygon }, layers, binary);
+      });
+    Report(label, binary ? "extrusion-binary" : "extrusion", input.name,
+           work, t);
+  }
+
+  // Printer alone: extruding the layers as they come from the extrusion.
+  std::vector<double> x(polygon.size()), y(polygon.size()), z(polygon.size());
+  std::vector<double> segment_len(polygon.size());
+  for (size_t i = 0; i < polygon.size(); ++i) {
+    const Vector2D p = FromFixed(polygon[i]);
+    x[i] = p.x; y[i] = p.y;
+    z[i] = kLayerHeight * i / polygon.size();
+    const Vector2D prev = FromFixed(polygon[i > 0 ? i - 1 : polygon.size()-1]);
+    segment_len[i] = (p - prev).magnitude();
+  }
+  Work printer_work = { 0, 0, 0 };
+  const double printer_time = Measure(min_time, [&](int) {
+      OutputBuffer *out = new OutputBuffer();
+      Printer *printer = CreateGCodePrinter(out, kExtrusionFactor, 1.2, 190,
+                                            -1, 0, kMotionLimits);
+      printer->SetSpeed(100);
+      printer_work = { 0, 0, 0 };
+      for (int l = 0; l < layers; ++l) {
+        printer->ExtrudePath(x.data(), y.data(), z.data(), segment_len.data(),
+                             x.size(), 1.0);
+        printer_work.vertices += x.size();
+        ++printer_work.layers;
+        printer_work.bytes += out->size();
+        out->Clear();
+      }
+      delete printer;
+    });
+  Report(label, "gcode-printer", input.name, printer_work, printer_time);
+
+  if (!with_offsets)
+    return;
+
+  // Whole pipeline: three shells around the polygon, like
+  // multi-shell-extrude -n 3; new offsets in each run to not hit the cache.
+  Work pipeline_work;
+  const double pipeline_time = Measure(min_time, [&](int run) {
+      std::vector<double> offsets;
+      for (int i = 0; i < 3; ++i) {
+        offsets.push_back(input.offset * (i + run * 1e-4));
+      }
+      pipeline_work = ExtrudeScrews(
+        PolygonOffsetLadder(polygon, offsets, false, kOffsetRound, 1),
+        layers, false);
+    });
+  Report(label, "pipeline", input.name, pipeline_work, pipeline_time);
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  ParameterRegistry parameters;
+  StringParam sample_dir("sample", "sample-dir", 0, "Directory with *.poly files to use as input");
+  IntParam max_vertices(1 << 20, "max-vertices", 0, "Largest synthetic polygon to use");
+  IntParam max_offset_vertices(1 << 16, "max-offset-vertices", 0, "Largest polygon to measure offsets with. Clipper gets slow with space filling curves");
+  FloatParam min_time(0.5, "min-time", 0, "Repeat each measurement at least this many seconds");
+  StringParam label("", "label", 0, "Label added to each result, e.g. the commit");
+
+  if (!parameters.SetFromCommandline(argc, argv)) {
+    return parameters.Usage(argv[0]);
+  }
+
+  std::vector<Input> inputs;
+  glob_t files;
+  const std::string pattern = sample_dir.get() + "/*.poly";
+  if (glob(pattern.c_str(), 0, NULL, &files) == 0) {
+    for (size_t i = 0; i < files.gl_pathc; ++i) {
+      const std::string path = files.gl_pathv[i];
+      inputs.push_back({ path.substr(path.find_last_of('/') + 1),
+                         Centered(ReadPolygon(path, 3.5, 0.01)), 1.2 });
+    }
+    globfree(&files);
+  }
+
+  // Templates: the default screw, and dense ones with long template
+  // strings and tight tolerance.
+  for (const int length : { 15, 1000, 10000 }) {
+    std::string screw_template;
+    for (int i = 0; i < length; ++i) {
+      screw_template.append(1, "AABBB"[i % 5] + (i / 5) % 3);
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "template-%d", length);
+    Polygon polygon;
+    const double t = Measure(min_time, [&](int) {
+        polygon = RotationalPolygon(screw_template.c_str(), 20, 4, 0.1,
+                                    0.0001);
+      });
+    const Work work = { (int64_t)polygon.size(), 0, 0 };
+    Report(label, "rotational-polygon", name, work, t);
+    inputs.push_back({ name, Centered(polygon), 1.2 });
+  }
+
+  // Moore curves of about 100mm with 10^4 .. 10^6 vertices. Parts of the
+  // curve are only a grid step apart; offsets larger than half of that
+  // merge them, which is a lot of work for little use. So shells are a
+  // quarter step apart.
+  for (int depth = 6; (1 << (2 * (depth + 1))) <= max_vertices; ++depth) {
+    const double step = 100.0 / (1 << (depth + 1));
+    MooreCurve curve(step);
+    const Polygon polygon = curve.Create(depth);
+    inputs.push_back({ "moore-" + std::to_string(polygon.size()), polygon,
+                       step / 4 });
+  }
+
+  for (const Input &input : inputs) {
+    if (input.polygon.size() < 3) {
+      fprintf(stderr, "Skipping %s: no polygon\n", input.name.c_str());
+      continue;
+    }
+    Benchmark(input, min_time,
+              (int)input.polygon.size() <= max_offset_vertices, label);
+  }
+  return 0;
+}
@@ -0,0 +1,37 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+// Convert binary GCode created with multi-shell-extrude --binary-gcode back
+// to ASCII GCode.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "binary-gcode.h"
+#include "output-buffer.h"
+
+int main(int argc, char *argv[]) {
+  if (argc > 2) {
+    fprintf(stderr, "usage: %s [binary-gcode-file]\n"
+            "Reads from stdin if no file given, writes GCode to stdout.\n",
+            argv[0]);
+    return 1;
+  }
+  int in_fd = STDIN_FILENO;
+  if (argc == 2 && strcmp(argv[1], "-") != 0) {
+    in_fd = open(argv[1], O_RDONLY);
+    if (in_fd < 0) {
+      perror(argv[1]);
+      return 1;
+    }
+  }
+  OutputBuffer out(STDOUT_FILENO);
+  const bool success = DecodeBinaryGCode(in_fd, &out);
+  out.Flush();
+  close(in_fd);
+  return success ? 0 : 1;
+}
@@ -0,0 +1,364 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "binary-gcode.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "output-buffer.h"
+
+namespace {
+const char kMagic[4] = { 'M', 'S', 'X', 'B' };
+const uint32_t kVersion = 2;   // 2: with end block.
+const uint16_t kChecksumCRC32 = 1;
+
+enum BlockType { kMetadataBlock = 0, kGCodeBlock = 1, kEndBlock = 2 };
+enum Compression { kCompressNone = 0, kCompressDeflate = 1 };
+enum RecordTag {
+  kTextRecord = 0, kMoveRecord = 1, kExtrudeRecord = 2, kZMoveRecord = 3,
+  kCWArcRecord = 4, kCCWArcRecord = 5
+};
+
+const size_t kBlockSize = 64 << 10;   // Uncompressed payload per block.
+const size_t kBlockHeaderSize = 12;
+const int kDecimals = 3;              // Units are 1/1000mm
+
+void PutLE(std::string *out, uint32_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out->push_back(value & 0xff);
+    value >>= 8;
+  }
+}
+
+uint32_t GetLE(const unsigned char *in, int bytes) {
+  uint32_t result = 0;
+  for (int i = bytes - 1; i >= 0; --i) {
+    result = (result << 8) | in[i];
+  }
+  return result;
+}
+}  // namespace
+
+BinaryGCodeWriter::BinaryGCodeWriter(OutputBuffer *out)
+  : out_(out), last_x_(0), last_y_(0), last_z_(0), last_e_(0),
+    started_(false), finished_(false) {
+  block_.reserve(kBlockSize + 64);
+}
+
+BinaryGCodeWriter::~BinaryGCodeWriter() {
+  Finish();
+}
+
+void BinaryGCodeWriter::WriteHeader(const std::string &metadata) {
+  std::string header(kMagic, sizeof(kMagic));
+  PutLE(&header, kVersion, 4);
+  PutLE(&header, kChecksumCRC32, 2);
+  out_->Append(header.data(), header.size());
+  WriteBlock(kMetadataBlock, metadata);
+  started_ = true;
+}
+
+void BinaryGCodeWriter::WriteBlock(uint16_t type, const std::string &payload) {
+  std::string block;
+  uLongf compressed_size = compressBound(payload.size());
+  std::string compressed(compressed_size, '\0');
+  uint16_t compression = kCompressNone;
+  if (compress2((Bytef*) &compressed[0], &compressed_size,
+                (const Bytef*) payload.data(), payload.size(),
+                Z_DEFAULT_COMPRESSION) == Z_OK
+      && compressed_size < payload.size()) {
+    compression = kCompressDeflate;
+    compressed.resize(compressed_size);
+  } else {
+    compressed = payload;
+  }
+  PutLE(&block, type, 2);
+  PutLE(&block, compression, 2);
+  PutLE(&block, payload.size(), 4);
+  PutLE(&block, compressed.size(), 4);
+  block.append(compressed);
+  PutLE(&block, crc32(0, (const Bytef*) block.data(), block.size()), 4);
+  out_->Append(block.data(), block.size());
+}
+
+void BinaryGCodeWriter::StartRecord(uint8_t tag) {
+  if (block_.size() >= kBlockSize) {
+    WriteBlock(kGCodeBlock, block_);
+    block_.clear();
+    last_x_ = last_y_ = last_z_ = last_e_ = 0;
+  }
+  block_.push_back(tag);
+}
+
+void BinaryGCodeWriter::AddVarint(uint64_t value) {
+  while (value >= 0x80) {
+    block_.push_back((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  block_.push_back(value);
+}
+
+void BinaryGCodeWriter::AddZigZag(int64_t value) {
+  AddVarint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+void BinaryGCodeWriter::AddDelta(int64_t value, int64_t *last) {
+  AddZigZag(value - *last);
+  *last = value;
+}
+
+void BinaryGCodeWriter::AddText(const char *text, size_t len) {
+  if (len == 0) return;
+  StartRecord(kTextRecord);
+  AddVarint(len);
+  block_.append(text, len);
+}
+
+void BinaryGCodeWriter::AddMove(int64_t x, int64_t y, int64_t z) {
+  StartRecord(kMoveRecord);
+  AddDelta(x, &last_x_);
+  AddDelta(y, &last_y_);
+  AddDelta(z, &last_z_);
+}
+
+void BinaryGCodeWriter::AddExtrude(int64_t x, int64_t y, int64_t z,
+                                   int64_t e) {
+  StartRecord(kExtrudeRecord);
+  AddDelta(x, &last_x_);
+  AddDelta(y, &last_y_);
+  AddDelta(z, &last_z_);
+  AddDelta(e, &last_e_);
+}
+
+void BinaryGCodeWriter::AddZMove(int64_t z) {
+  StartRecord(kZMoveRecord);
+  AddDelta(z, &last_z_);
+}
+
+void BinaryGCodeWriter::AddArc(bool clockwise, int64_t x, int64_t y,
+                               int64_t z, int64_t i, int64_t j, int64_t e) {
+  StartRecord(clockwise ? kCWArcRecord : kCCWArcRecord);
+  AddDelta(x, &last_x_);
+  AddDelta(y, &last_y_);
+  AddDelta(z, &last_z_);
+  AddZigZag(i);
+  AddZigZag(j);
+  AddDelta(e, &last_e_);
+}
+
+void BinaryGCodeWriter::Finish() {
+  if (!started_ || finished_)
+    return;
+  if (!block_.empty()) {
+    WriteBlock(kGCodeBlock, block_);
+    block_.clear();
+    last_x_ = last_y_ = last_z_ = last_e_ = 0;
+  }
+  WriteBlock(kEndBlock, "");
+  finished_ = true;
+}
+
+// -- Decoding
+
+namespace {
+bool ReadFully(int fd, void *buffer, size_t len) {
+  char *pos = (char*) buffer;
+  while (len > 0) {
+    const ssize_t r = read(fd, pos, len);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return false;
+    pos += r;
+    len -= r;
+  }
+  return true;
+}
+
+class RecordReader {
+public:
+  RecordReader(const std::string &data) : pos_(data.data()),
+                                          end_(data.data() + data.size()) {}
+  bool done() const { return pos_ >= end_; }
+  bool ReadByte(uint8_t *b) {
+    if (pos_ >= end_) return false;
+    *b = *pos_++;
+    return true;
+  }
+  bool ReadVarint(uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && pos_ < end_; shift += 7) {
+      const uint8_t b = *pos_++;
+      *value |= (uint64_t)(b & 0x7f) << shift;
+      if ((b & 0x80) == 0) return true;
+    }
+    return false;
+  }
+  bool ReadZigZag(int64_t *value) {
+    uint64_t v;
+    if (!ReadVarint(&v)) return false;
+    *value = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    return true;
+  }
+  bool ReadDelta(int64_t *value) {
+    int64_t delta;
+    if (!ReadZigZag(&delta)) return false;
+    *value += delta;
+    return true;
+  }
+  bool ReadBytes(size_t len, const char **data) {
+    if (len > (size_t)(end_ - pos_)) return false;
+    *data = pos_;
+    pos_ += len;
+    return true;
+  }
+
+private:
+  const char *pos_;
+  const char *const end_;
+};
+
+bool DecodeGCodeBlock(const std::string &payload, OutputBuffer *out) {
+  RecordReader reader(payload);
+  int64_t x = 0, y = 0, z = 0, e = 0;
+  uint8_t tag;
+  while (reader.ReadByte(&tag)) {
+    switch (tag) {
+    case kTextRecord: {
+      uint64_t len;
+      const char *text;
+      if (!reader.ReadVarint(&len) || !reader.ReadBytes(len, &text))
+        return false;
+      out->Append(text, len);
+      break;
+    }
+    case kMoveRecord:
+    case kExtrudeRecord:
+      if (!reader.ReadDelta(&x) || !reader.ReadDelta(&y)
+          || !reader.ReadDelta(&z))
+        return false;
+      out->Append("G1 X"); out->AppendScaled(x, kDecimals);
+      out->Append(" Y");   out->AppendScaled(y, kDecimals);
+      out->Append(" Z");   out->AppendScaled(z, kDecimals);
+      if (tag == kExtrudeRecord) {
+        if (!reader.ReadDelta(&e))
+          return false;
+        out->Append(" E"); out->AppendScaled(e, kDecimals);
+      }
+      out->Append('\n');
+      break;
+    case kCWArcRecord:
+    case kCCWArcRecord: {
+      int64_t i, j;
+      if (!reader.ReadDelta(&x) || !reader.ReadDelta(&y)
+          || !reader.ReadDelta(&z) || !reader.ReadZigZag(&i)
+          || !reader.ReadZigZag(&j) || !reader.ReadDelta(&e))
+        return false;
+      out->Append(tag == kCWArcRecord ? "G2 X" : "G3 X");
+      out->AppendScaled(x, kDecimals);
+      out->Append(" Y"); out->AppendScaled(y, kDecimals);
+      out->Append(" Z"); out->AppendScaled(z, kDecimals);
+      out->Append(" I"); out->AppendScaled(i, kDecimals);
+      out->Append(" J"); out->AppendScaled(j, kDecimals);
+      out->Append(" E"); out->AppendScaled(e, kDecimals);
+      out->Append('\n');
+      break;
+    }
+    case kZMoveRecord:
+      if (!reader.ReadDelta(&z))
+        return false;
+      out->Append("G1 Z"); out->AppendScaled(z, kDecimals);
+      out->Append('\n');
+      break;
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+}  // namespace
+
+bool DecodeBinaryGCode(int in_fd, OutputBuffer *out) {
+  unsigned char file_header[10];
+  if (!ReadFully(in_fd, file_header, sizeof(file_header))
+      || memcmp(file_header, kMagic, sizeof(kMagic)) != 0) {
+    fprintf(stderr, "Not a binary GCode file.\n");
+    return false;
+  }
+  if (GetLE(file_header + 4, 4) != kVersion) {
+    fprintf(stderr, "Unsupported version %u\n", GetLE(file_header + 4, 4));
+    return false;
+  }
+
+  // Same start as ASCII GCode from the GCodePrinter.
+  out->Append("(G-Code)\n\n");
+
+  unsigned char header[kBlockHeaderSize];
+  std::string compressed, payload;
+  for (;;) {
+    if (!ReadFully(in_fd, header, sizeof(header))) {
+      fprintf(stderr, "Truncated file: no end block.\n");
+      return false;
+    }
+    const uint16_t type = GetLE(header, 2);
+    const uint16_t compression = GetLE(header + 2, 2);
+    const uint32_t size = GetLE(header + 4, 4);
+    const uint32_t compressed_size = GetLE(header + 8, 4);
+    unsigned char checksum[4];
+    compressed.resize(compressed_size);
+    if (!ReadFully(in_fd, &compressed[0], compressed_size)
+        || !ReadFully(in_fd, checksum, sizeof(checksum))) {
+      fprintf(stderr, "Truncated block.\n");
+      return false;
+    }
+    uLong crc = crc32(0, header, sizeof(header));
+    crc = crc32(crc, (const Bytef*) compressed.data(), compressed.size());
+    if (crc != GetLE(checksum, 4)) {
+      fprintf(stderr, "Checksum mismatch.\n");
+      return false;
+    }
+    if (compression == kCompressDeflate) {
+      payload.resize(size);
+      uLongf len = size;
+      if (uncompress((Bytef*) &payload[0], &len,
+                     (const Bytef*) compressed.data(), compressed.size())
+          != Z_OK || len != size) {
+        fprintf(stderr, "Invalid compressed block.\n");
+        return false;
+      }
+    } else if (compression == kCompressNone) {
+      payload.swap(compressed);
+    } else {
+      fprintf(stderr, "Unknown compression %d\n", compression);
+      return false;
+    }
+
+    if (type == kEndBlock) {
+      return true;
+    } else if (type == kMetadataBlock) {
+      // One comment per line; the last might not end in a newline.
+      size_t start = 0;
+      while (start < payload.size()) {
+        size_t eol = payload.find('\n', start);
+        out->Append("; ");
+        if (eol == std::string::npos) {
+          out->Append(payload.data() + start, payload.size() - start);
+          out->Append('\n');
+          break;
+        }
+        out->Append(payload.data() + start, eol - start + 1);
+        start = eol + 1;
+      }
+    } else if (type == kGCodeBlock) {
+      if (!DecodeGCodeBlock(payload, out)) {
+        fprintf(stderr, "Invalid GCode block.\n");
+        return false;
+      }
+    }
+    // Unknown blocks are skipped.
+  }
+}
@@ -0,0 +1,78 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_BINARY_GCODE_H_
+#define SHELL_EXTRUDE_BINARY_GCODE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+class OutputBuffer;
+
+// A block structured binary container for GCode, in the spirit of the
+// bgcode format: ASCII GCode of our multi-shell prints is mostly
+// "G1 X.. Y.. Z.. E.." lines with tiny changes from line to line, which
+// delta-encodes and compresses very well.
+//
+// All integers are little endian.
+//   File header: "MSXB" magic, u32 version, u16 checksum type (1 = CRC32).
+//   Each block:  u16 block type, u16 compression (0 = none, 1 = deflate),
+//                u32 uncompressed size, u32 compressed size,
+//                payload, u32 CRC32 over block header and payload.
+//
+// The metadata block comes first and contains the comment lines of the
+// file header, one per line, without the comment character. An empty end
+// block comes last, so that a truncated file is recognized as such.
+// GCode blocks contain a sequence of records, each starting with a tag byte
+//   kTextRecord:    varint length, followed by verbatim ASCII GCode.
+//   kMoveRecord:    "G1 X Y Z"   zigzag varint deltas of X, Y, Z
+//   kExtrudeRecord: "G1 X Y Z E" zigzag varint deltas of X, Y, Z, E
+//   kZMoveRecord:   "G1 Z"       zigzag varint delta of Z
+//   kCWArcRecord:   "G2 X Y Z I J E" zigzag varint deltas of X, Y, Z, then
+//                   zigzag varint of I, J (not delta), delta of E.
+//   kCCWArcRecord:  "G3 X Y Z I J E" same as kCWArcRecord.
+// Values are in units of 1/1000mm, deltas relative to the previous record
+// in the same block, so every block can be decoded on its own.
+class BinaryGCodeWriter {
+public:
+  // Writes to "out", which is not owned.
+  explicit BinaryGCodeWriter(OutputBuffer *out);
+  ~BinaryGCodeWriter();  // Finishes the last block.
+
+  // Write file header and metadata block. Needs to be called first.
+  void WriteHeader(const std::string &metadata);
+
+  // Add GCode. Blocks are written to the output as they fill up.
+  void AddText(const char *text, size_t len);
+  void AddMove(int64_t x, int64_t y, int64_t z);
+  void AddExtrude(int64_t x, int64_t y, int64_t z, int64_t e);
+  void AddZMove(int64_t z);
+  void AddArc(bool clockwise, int64_t x, int64_t y, int64_t z,
+              int64_t i, int64_t j, int64_t e);
+
+  // Write out any pending block and the end block. Nothing can be added
+  // after.
+  void Finish();
+
+private:
+  void StartRecord(uint8_t tag);
+  void AddVarint(uint64_t value);
+  void AddDelta(int64_t value, int64_t *last);
+  void AddZigZag(int64_t value);
+  void WriteBlock(uint16_t type, const std::string &payload);
+
+  OutputBuffer *const out_;
+  std::string block_;   // Currently assembled GCode block.
+  int64_t last_x_, last_y_, last_z_, last_e_;
+  bool started_;    // Header is written.
+  bool finished_;   // End block is written.
+};
+
+// Read binary GCode from file descriptor "in_fd" and write it as ASCII
+// GCode to "out". Returns false if the input is not valid.
+bool DecodeBinaryGCode(int in_fd, OutputBuffer *out);
+
+#endif  // SHELL_EXTRUDE_BINARY_GCODE_H_
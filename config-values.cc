@@ -7,26 +7,32 @@
 
 #include "config-values.h"
 
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <getopt.h>
 
+#include <mutex>
 #include <vector>
 
-using std::vector;
+// Registry new parameters are added to.
+static thread_local ParameterRegistry *sCurrentRegistry = NULL;
 
-// For simplicity, we keep the parameters all in a global list.
-typedef vector<Parameter*> ParamList;
-static ParamList *sRegisteredParameters = NULL;
+ParameterRegistry::ParameterRegistry() : previous_(sCurrentRegistry) {
+  sCurrentRegistry = this;
+}
+
+ParameterRegistry::~ParameterRegistry() {
+  sCurrentRegistry = previous_;
+}
 
 Parameter::Parameter(const char *option_name_in,
                      char option_char_in, const char *helptext_in)
   : option_name(option_name_in),
     option_char(option_char_in), helptext(helptext_in) {
-  if (sRegisteredParameters == NULL)
-    sRegisteredParameters = new ParamList();
-  sRegisteredParameters->push_back(this);
+  assert(sCurrentRegistry != NULL);  // Parameters need a ParameterRegistry.
+  sCurrentRegistry->parameters_.push_back(this);
 }
 
 // Some specializations
@@ -91,15 +97,13 @@ template<> bool TypedParameter<Vector2D>::RequiresValue() const {
   return true;
 }
 
-int ParameterUsage(const char *progname) {
+int ParameterRegistry::Usage(const char *progname) const {
   fprintf(stderr, "usage: %s [options]\n", progname);
-  if (!sRegisteredParameters)
-    return 1;
   const int kIndentBetweenOptionAndHelp = 26;
   fprintf(stderr, "Synopsis:\n... Long option%*s[short]: <help>\n",
           kIndentBetweenOptionAndHelp - 16, "");
-  for (ParamList::const_iterator it = sRegisteredParameters->begin();
-       it != sRegisteredParameters->end(); ++it) {
+  for (std::vector<Parameter*>::const_iterator it = parameters_.begin();
+       it != parameters_.end(); ++it) {
     int indent = kIndentBetweenOptionAndHelp;
     const Parameter *const p = *it;
     if (p->option_name == NULL && p->option_char == 0) {
@@ -126,15 +130,20 @@ int ParameterUsage(const char *progname) {
   return 1;
 }
 
-bool SetParametersFromCommandline(int argc, char *argv[]) {
-  if (sRegisteredParameters == NULL)
-    return true;
+const Parameter *ParameterRegistry::Find(const char *option_name) const {
+  for (const Parameter *p : parameters_) {
+    if (p->option_name && strcmp(p->option_name, option_name) == 0)
+      return p;
+  }
+  return NULL;
+}
 
+bool ParameterRegistry::SetFromCommandline(int argc, char *argv[]) {
   std::string optstring;
-  struct option *long_options = new option [ sRegisteredParameters->size() + 1 ];
+  struct option *long_options = new option [ parameters_.size() + 1 ];
   int opt_idx = 0;
-  for (size_t i = 0; i < sRegisteredParameters->size(); ++i) {
-    const Parameter *const p = (*sRegisteredParameters)[i];
+  for (size_t i = 0; i < parameters_.size(); ++i) {
+    const Parameter *const p = parameters_[i];
     if (p->option_name == NULL && p->option_char == 0) {
       continue;
     }
@@ -148,17 +157,22 @@ bool SetParametersFromCommandline(int argc, char *argv[]) {
     opt->flag = NULL;
     opt->val = i + 256;
   }
+  memset(&long_options[opt_idx], 0, sizeof(long_options[opt_idx]));  // End.
   const char *optstr = optstring.c_str();
   bool success = true;
   int opt;
   int arg_idx = 0;
+  // getopt_long() keeps its state in globals.
+  static std::mutex getopt_mutex;
+  std::lock_guard<std::mutex> l(getopt_mutex);
+  optind = 0;   // Start from the beginning, also if called before.
   while ((opt = getopt_long(argc, argv, optstr, long_options, &arg_idx)) >= 0) {
     if (opt == '?') {
       success = false;
       break;
     }
-    for (size_t i = 0; i < sRegisteredParameters->size(); ++i) {
-      Parameter *const p = (*sRegisteredParameters)[i];
+    for (size_t i = 0; i < parameters_.size(); ++i) {
+      Parameter *const p = parameters_[i];
       if (opt == p->option_char || opt == (int) (i + 256)) {
         p->FromString(optarg);
       }
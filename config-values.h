@@ -6,16 +6,44 @@
 #define SHELL_EXTRUDE_CONFIG_VALUES_H_
 
 #include <string>
+#include <vector>
 
 #include "multi-shell-extrude.h"   // Definition of Vector2D
 
-// Prints usage of paramters to STDERR.
-// Always returns 1 (convenient to return from main()).
-int ParameterUsage(const char *progname);
+class Parameter;
+
+// The set of parameters of one job. Parameters created while a registry
+// exists register with the most recently created one in the same thread, so
+// each job can have its own set of parameters as local variables:
+//
+//   ParameterRegistry parameters;
+//   FloatParam height(-1, "height", 'h', "Total height");
+//   if (!parameters.SetFromCommandline(argc, argv)) ...
+//
+// The registry needs to outlive its parameters.
+class ParameterRegistry {
+public:
+  ParameterRegistry();
+  ~ParameterRegistry();
+
+  // Prints usage of paramters to STDERR.
+  // Always returns 1 (convenient to return from main()).
+  int Usage(const char *progname) const;
+
+  // Set all parameters from commandline. Returns 'true' on success.
+  // Can be called from multiple threads.
+  bool SetFromCommandline(int argc, char *argv[]);
+  // TODO, others like SetFromConfigFile()
+
+  // Parameter with the given long option name; NULL if there is none.
+  const Parameter *Find(const char *option_name) const;
 
-// Set all parameters from commandline. Returns 'true' on success.
-bool SetParametersFromCommandline(int argc, char *argv[]);
-// TODO, others like SetParameterFromConfigFile()
+private:
+  friend class Parameter;
+
+  ParameterRegistry *const previous_;   // Registry active before this one.
+  std::vector<Parameter*> parameters_;
+};
 
 // Classes to deal with configuration parameters. In general we want the
 // parameters look like read-only values (they all have operator T())),
@@ -0,0 +1,366 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "extrusion.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "arc-fit.h"
+#include "layer-kernel.h"
+#include "printer.h"
+
+// Get temperature for layer. Right now, this is a simple sin(), but
+// could be something more pleasingly erratic, such as Perlin noise.
+static float GetLayerTemperature(float base_temp, float variation,
+                                 float height, float noise_feature) {
+  return sin(2 * M_PI * height / noise_feature) * variation + base_temp;
+}
+
+static void BuildLayerTemplate(const Polygon &p, double rotation_per_layer,
+                               double layer_height, LayerTemplate *result) {
+  const double polygon_len = CalcPolygonLen(p);
+  result->resize(p.size());
+  double run_len = 0;
+  for (int i = 0; i < (int)p.size(); ++i) {
+    if (i > 0) {
+      run_len += distance(FromFixed(p[i].x - p[i - 1].x),
+                          FromFixed(p[i].y - p[i - 1].y), 0);
+    }
+    const double fraction = run_len / polygon_len;
+    const double a = fraction * rotation_per_layer;
+    // This is where we go from fixed point to floating point.
+    const Vector2D v = FromFixed(p[i]);
+    result->x[i] = v.x * cos(a) - v.y * sin(a);
+    result->y[i] = v.y * cos(a) + v.x * sin(a);
+    result->z_ramp[i] = layer_height * fraction;
+  }
+}
+
+// Time a printer with "limits" needs to print a layer of "layer" at
+// "feedrate". Layers follow each other without stop, so that is the
+// difference between printing two layers and one.
+static double SimulateLayerTime(const LayerTemplate &layer,
+                                double layer_height,
+                                const MotionLimits &limits, double feedrate) {
+  MotionPlanner planner(limits);
+  double first_layer_time = 0;
+  for (int l = 0; l < 2; ++l) {
+    for (size_t i = 0; i < layer.size(); ++i) {
+      planner.MoveTo(layer.x[i], layer.y[i],
+                     l * layer_height + layer.z_ramp[i], feedrate);
+    }
+    if (l == 0) first_layer_time = planner.GetTime();
+  }
+  return planner.GetTime() - first_layer_time;
+}
+
+// Determine the fastest feedrate up to "max_feedrate", at which a layer still
+// takes at least "min_layer_time" to print. Layers of short segments and
+// corners hardly reach the nominal feedrate, so the feedrate can be higher
+// than polygon length / min_layer_time. "min_feedrate" is that value; it
+// always fulfills the minimum layer time.
+static double PlanLayerFeedrate(const LayerTemplate &layer,
+                                double layer_height,
+                                const MotionLimits &limits,
+                                double min_feedrate, double max_feedrate,
+                                double min_layer_time) {
+  if (min_feedrate >= max_feedrate
+      || SimulateLayerTime(layer, layer_height, limits,
+                           max_feedrate) >= min_layer_time) {
+    return max_feedrate;
+  }
+  // Layer time decreases with feedrate. Binary search to within 0.1%.
+  double good = min_feedrate, bad = max_feedrate;
+  while (bad - good > 0.001 * good) {
+    const double feedrate = (good + bad) / 2;
+    if (SimulateLayerTime(layer, layer_height, limits,
+                          feedrate) >= min_layer_time) {
+      good = feedrate;
+    } else {
+      bad = feedrate;
+    }
+  }
+  return good;
+}
+
+// Feedrate changes smaller than this don't matter; they'd only cost an F
+// command in the output.
+static const double kMinFeedrateChange = 1.0;   // mm/s
+
+// Experimental. Locking screws do have smaller/larger diameter at their
+// ends: the first and last kLockOverlap mm are offset by the lock_offset.
+static const int kLockOverlap = 3;
+enum LockState { START, WIDE_LOCK, NORMAL, NARROW_LOCK };
+
+// Go through the lock state transitions for the layer at "height". Returns
+// true if the polygon to print changes; it is then stored in "p".
+// For locking screw we're very simple: we just offset the polygon, but don't
+// do any transition for now.
+// TODO: re-arrange polygon to start at same angle.
+static bool NextLockState(const Polygon &extrusion_polygon,
+                          const ExtrusionParams &params, double height,
+                          LockState *state, Polygon *p) {
+  const bool do_lock = (params.lock_offset > 0);
+  switch (*state) {
+  case START:
+    if (do_lock) {
+      *state = WIDE_LOCK;
+      *p = PolygonOffset(extrusion_polygon, params.lock_offset);
+    } else {
+      *state = NORMAL;
+      *p = extrusion_polygon;
+    }
+    return true;
+
+  case WIDE_LOCK:
+    if (do_lock && height > kLockOverlap) {
+      *p = extrusion_polygon;
+      *state = NORMAL;
+      return true;
+    }
+    break;
+
+  case NORMAL:
+    if (do_lock && height > params.total_height - kLockOverlap) {
+      *p = PolygonOffset(extrusion_polygon, -params.lock_offset);
+      *state = NARROW_LOCK;
+      return true;
+    }
+    break;
+  case NARROW_LOCK: /* terminal state */
+    break;
+  }
+  return false;
+}
+
+// Prepare printing layers of polygon "p", decimated in place if needed:
+// create the layer template and determine the feedrate. Returns the number
+// of segments removed by decimation.
+static int PrepareLayer(const ExtrusionParams &params,
+                        double rotation_per_layer, Polygon *p,
+                        LayerTemplate *layer, double *feedrate) {
+  BuildLayerTemplate(*p, rotation_per_layer, params.layer_height, layer);
+  double planned = params.feedrate;
+  if (params.plan_feedrate) {
+    planned = PlanLayerFeedrate(*layer, params.layer_height,
+                                params.motion_limits, params.feedrate,
+                                params.max_feedrate, params.min_layer_time);
+  }
+  int segments_removed = 0;
+  if (params.max_segment_rate > 0) {
+    // At the planned speed, shorter segments exceed the segment rate.
+    const size_t before = p->size();
+    *p = DecimatePolygon(*p, params.decimate_tolerance,
+                         planned / params.max_segment_rate);
+    segments_removed = before - p->size();
+    if (segments_removed > 0) {
+      BuildLayerTemplate(*p, rotation_per_layer, params.layer_height, layer);
+      // Fewer corners make the layer faster; planning again must not go
+      // above the feedrate we decimated for.
+      if (params.plan_feedrate) {
+        planned = PlanLayerFeedrate(*layer, params.layer_height,
+                                    params.motion_limits, params.feedrate,
+                                    planned, params.min_layer_time);
+      }
+    }
+  }
+  if (params.plan_feedrate) *feedrate = planned;
+  return segments_removed;
+}
+
+int CreateExtrusion(const Polygon &extrusion_polygon, Printer *printer,
+                    const Vector2D &center, const ExtrusionParams &params,
+                    std::vector<float> *layer_time) {
+  printer->Comment("Center X=%.1f Y=%.1f\n", center.x, center.y);
+  printer->SetColor(0, 0, 0);
+  const float z_bottom_offset = params.layer_height / 2;
+  const double rotation_per_layer =
+      params.layer_height * params.rotation_per_mm * 2 * M_PI;
+  bool fan_is_on = false;
+  printer->SwitchFan(false);
+  double height = 0;
+  double angle = 0;
+  Polygon p; // active polygon.
+  LayerTemplate layer;
+  std::vector<Arc> arcs;   // Arcs in the layer template.
+  LayerPath path;
+  Vector2D last_pos;   // Last position sent to the printer.
+  double last_z = 0;
+  double feedrate = params.feedrate;   // Feedrate of the active polygon.
+  int segments_removed = 0;
+  LockState state = START;
+  double layer_start_time = printer->GetPrintTime();
+  for (height = 0, angle = 0; height < params.total_height;
+       height += params.layer_height, angle += rotation_per_layer) {
+    printer->SetTemperature(GetLayerTemperature(
+        params.base_temp, params.temp_variation, height, 30));
+    if (NextLockState(extrusion_polygon, params, height, &state, &p)) {
+      segments_removed += PrepareLayer(params, rotation_per_layer, &p,
+                                       &layer, &feedrate);
+      // Rotation and translation of the template keeps arcs arcs, so we
+      // only need to find them once.
+      if (params.arc_tolerance > 0) {
+        arcs = FitArcs(layer.x.data(), layer.y.data(), layer.z_ramp.data(),
+                       layer.size(), params.arc_tolerance);
+      }
+      // First move slowly, so that we wipe potential nozzle leak extrusion
+      printer->SetSpeed(std::min(feedrate / 3, 15.0));
+      last_pos = FromFixed(p[0]) + center;
+      last_z = height + z_bottom_offset;
+      printer->MoveTo(last_pos, last_z);
+    }
+
+    TransformLayer(layer, cos(angle), sin(angle), center, height,
+                   last_pos, last_z, &path);
+    const int n = path.size();
+    last_pos = Vector2D(path.x[n-1], path.y[n-1]);
+    last_z = path.z[n-1];
+
+    // Most layers are extruded in full speed all the way. The z in a layer
+    // is monotonically increasing, so checking the ends is sufficient.
+    if (path.z[0] >= 4 * params.layer_height
+        && path.z[0] > z_bottom_offset / 2
+        && path.z[n-1] < params.total_height - 0.30 * params.layer_height) {
+      printer->SetSpeed(feedrate);
+      const double cos_angle = cos(angle), sin_angle = sin(angle);
+      int pos = 0;   // Next point to send.
+      for (const Arc &arc : arcs) {
+        printer->ExtrudePath(path.x.data() + pos, path.y.data() + pos,
+                             path.z.data() + pos, path.segment_len.data() + pos,
+                             arc.start + 1 - pos, 1.0);
+        const int first = arc.start + 1;
+        const Vector2D arc_center(
+          (arc.center.x * cos_angle - arc.center.y * sin_angle) + center.x,
+          (arc.center.y * cos_angle + arc.center.x * sin_angle) + center.y);
+        printer->ExtrudeArc(path.x.data() + first, path.y.data() + first,
+                            path.z.data() + first,
+                            path.segment_len.data() + first,
+                            arc.end + 1 - first, arc_center, arc.clockwise,
+                            1.0);
+        pos = arc.end + 1;
+      }
+      printer->ExtrudePath(path.x.data() + pos, path.y.data() + pos,
+                           path.z.data() + pos, path.segment_len.data() + pos,
+                           n - pos, 1.0);
+    } else {
+      for (int i = 0; i < n; ++i) {
+        const Vector2D point(path.x[i], path.y[i]);
+        const double z = path.z[i];
+        const bool is_initial_layers = z < 2 * params.layer_height;
+        // Speed: keep slow while initial layers, then lerp-ing up to full
+        // speed within 4 more layers
+        if (is_initial_layers) {
+          printer->SetSpeed(feedrate * params.first_layer_feedrate_multiplier);
+        } else if (z < 4 * params.layer_height) {
+          const double range = 1.0 - params.first_layer_feedrate_multiplier;
+          const double lerp = (z - 2 *  params.layer_height)
+            / ((4 - 2) * params.layer_height);
+          const double speed = feedrate * (params.first_layer_feedrate_multiplier
+                                           + lerp * range);
+          // Slow layers are not rounded to 0.
+          const double rounded = (speed < kMinFeedrateChange)
+            ? speed : kMinFeedrateChange * round(speed / kMinFeedrateChange);
+          printer->SetSpeed(std::min(feedrate, rounded));
+        } else {
+          printer->SetSpeed(feedrate);
+        }
+        // Start only extruding when min z-offset reached and also stop extruding
+        // at the top to wipe off excess
+        if (z > z_bottom_offset / 2 &&
+            z < params.total_height - 0.30 * params.layer_height) {
+          printer->ExtrudeTo(point, z,
+                             (is_initial_layers)
+                             ? params.elephant_foot_multiplier
+                             : 1.0);
+        } else {
+          // In the last layer, we stop extruding to have a smooth finish.
+          printer->MoveTo(point, z);
+        }
+      }
+    }
+
+    if (height > params.fan_on_height && !fan_is_on) {
+      printer->SwitchFan(true); // reached fan-on height: switch on.
+      fan_is_on = true;
+    }
+    const double layer_end_time = printer->GetPrintTime();
+    layer_time->push_back(layer_end_time - layer_start_time);
+    layer_start_time = layer_end_time;
+  }
+  return segments_removed;
+}
+
+// Length of one layer of "layer", including the segment up to the start of
+// the next layer, which is rotated by "rotation_per_layer".
+static double LayerLength(const LayerTemplate &layer,
+                          double rotation_per_layer, double layer_height) {
+  const int n = layer.size();
+  double len = 0;
+  for (int i = 1; i < n; ++i) {
+    len += distance(layer.x[i] - layer.x[i-1], layer.y[i] - layer.y[i-1],
+                    layer.z_ramp[i] - layer.z_ramp[i-1]);
+  }
+  const double c = cos(rotation_per_layer), s = sin(rotation_per_layer);
+  const double next_x = layer.x[0] * c - layer.y[0] * s;
+  const double next_y = layer.y[0] * c + layer.x[0] * s;
+  return len + distance(next_x - layer.x[n-1], next_y - layer.y[n-1],
+                        layer_height - layer.z_ramp[n-1]);
+}
+
+// Time to print from height 0 up to "z" relative to printing it at full
+// feedrate, as the first layers are printed slower: at "multiplier" up to
+// two layers, then linearly speeding up within two more layers.
+static double SlowStartTime(double z, double layer_height, double multiplier) {
+  const double slow = std::min(z, 2 * layer_height);
+  double result = slow / multiplier;
+  if (z <= 2 * layer_height)
+    return result;
+  const double ramp = std::min(z, 4 * layer_height) - 2 * layer_height;
+  if (multiplier < 1) {
+    // Integral of 1/speed over the linear speed increase.
+    const double slope = (1 - multiplier) / (2 * layer_height);
+    result += log((multiplier + slope * ramp) / multiplier) / slope;
+  } else {
+    result += ramp;
+  }
+  return result + std::max(0.0, z - 4 * layer_height);
+}
+
+ExtrusionEstimate EstimateExtrusion(const Polygon &extrusion_polygon,
+                                    const ExtrusionParams &params,
+                                    std::vector<float> *layer_time) {
+  ExtrusionEstimate result = { 0, 0 };
+  const double h = params.layer_height;
+  const double rotation_per_layer = h * params.rotation_per_mm * 2 * M_PI;
+  // Range of heights that are extruded, as in CreateExtrusion().
+  const double extrude_from = h / 4;
+  const double extrude_to = params.total_height - 0.30 * h;
+  Polygon p;
+  LayerTemplate layer;
+  double feedrate = params.feedrate;
+  double layer_len = 0;    // Of the active polygon.
+  double time_per_layer = 0;
+  LockState state = START;
+  for (double height = 0; height < params.total_height; height += h) {
+    if (NextLockState(extrusion_polygon, params, height, &state, &p)) {
+      result.segments_removed += PrepareLayer(params, rotation_per_layer, &p,
+                                              &layer, &feedrate);
+      layer_len = LayerLength(layer, rotation_per_layer, h);
+      time_per_layer = SimulateLayerTime(layer, h, params.motion_limits,
+                                         feedrate);
+    }
+    // Height increases evenly along the layer.
+    const double from = std::min(std::max(height, extrude_from), extrude_to);
+    const double to = std::min(std::max(height + h, extrude_from), extrude_to);
+    result.distance += layer_len * (to - from) / h;
+    const double slow_start
+      = (SlowStartTime(height + h, h, params.first_layer_feedrate_multiplier)
+         - SlowStartTime(height, h, params.first_layer_feedrate_multiplier));
+    layer_time->push_back(time_per_layer * slow_start / h);
+  }
+  return result;
+}
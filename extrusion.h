@@ -0,0 +1,65 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_EXTRUSION_H_
+#define SHELL_EXTRUDE_EXTRUSION_H_
+
+#include <vector>
+
+#include "multi-shell-extrude.h"
+#include "motion-planner.h"
+
+class Printer;
+
+// Parameters for extruding a screw as a single spiral.
+struct ExtrusionParams {
+  double feedrate;
+  double layer_height;
+  double total_height;
+  double rotation_per_mm;
+  double lock_offset;
+  double fan_on_height;
+  double elephant_foot_multiplier;
+  double first_layer_feedrate_multiplier;
+  double arc_tolerance;   // Fit arcs if > 0.
+  double max_segment_rate;     // Segments/second. Decimate if > 0.
+  double decimate_tolerance;
+  // If set, speed up layers to the max_feedrate as long as they take at least
+  // min_layer_time with the given motion limits.
+  bool plan_feedrate;
+  double max_feedrate;
+  double min_layer_time;
+  MotionLimits motion_limits;
+
+  float base_temp;
+  float temp_variation;
+};
+
+// Extrude the "extrusion_polygon" at "center" as a single spiral up to the
+// total height, rotating rotation_per_mm.
+// Requires: Polygon with centroid on (0,0)
+// Returns the number of segments removed from polygons by decimation.
+// The estimated print time of each layer is appended to "layer_time".
+int CreateExtrusion(const Polygon &extrusion_polygon, Printer *printer,
+                    const Vector2D &center, const ExtrusionParams &params,
+                    std::vector<float> *layer_time);
+
+// What CreateExtrusion() does, estimated without creating the toolpath.
+struct ExtrusionEstimate {
+  double distance;        // Extrusion distance.
+  int segments_removed;   // By decimation.
+};
+
+// Estimate the extrusion distance and layer times of CreateExtrusion() with
+// the same polygon and parameters. All layers of a polygon are the same, so
+// only one layer of each polygon printed (with lock, normal) is looked at;
+// the cost does not depend on the number of layers times vertices.
+// Not included are moves between the polygons and rounding of the feedrate in
+// the first layers: distance is typically within 0.5%, time within 2%.
+// The estimated time of each layer is appended to "layer_time".
+ExtrusionEstimate EstimateExtrusion(const Polygon &extrusion_polygon,
+                                    const ExtrusionParams &params,
+                                    std::vector<float> *layer_time);
+
+#endif  // SHELL_EXTRUDE_EXTRUSION_H_
@@ -0,0 +1,194 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "layer-kernel.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define HAVE_X86_KERNELS 1
+#endif
+
+// Note: all the implementations need to do the same operations in the same
+// order, so that the output is the same independent of the CPU we run on.
+// So no FMA.
+
+DoubleArray::~DoubleArray() {
+  free(data_);
+}
+
+void DoubleArray::resize(size_t size) {
+  size_ = size;
+  const size_t padded = padded_size();
+  if (padded > capacity_) {
+    free(data_);
+    capacity_ = padded;
+    if (posix_memalign((void**) &data_, 32, capacity_ * sizeof(double)) != 0)
+      abort();
+  }
+  memset(data_ + size_, 0, (padded - size_) * sizeof(double));
+}
+
+// The first segment is relative to the start point, so always scalar.
+static void FirstSegment(const Vector2D &start, double start_z,
+                         LayerPath *out) {
+  if (out->size() == 0) return;
+  out->segment_len[0] = distance(out->x[0] - start.x, out->y[0] - start.y,
+                                 out->z[0] - start_z);
+}
+
+static void TransformLayerScalar(const LayerTemplate &t,
+                                 double cos_angle, double sin_angle,
+                                 const Vector2D &offset, double height,
+                                 const Vector2D &start, double start_z,
+                                 LayerPath *out) {
+  const size_t n = t.size();
+  for (size_t i = 0; i < n; ++i) {
+    out->x[i] = (t.x[i] * cos_angle - t.y[i] * sin_angle) + offset.x;
+    out->y[i] = (t.y[i] * cos_angle + t.x[i] * sin_angle) + offset.y;
+    out->z[i] = height + t.z_ramp[i];
+  }
+  FirstSegment(start, start_z, out);
+  for (size_t i = 1; i < n; ++i) {
+    out->segment_len[i] = distance(out->x[i] - out->x[i-1],
+                                   out->y[i] - out->y[i-1],
+                                   out->z[i] - out->z[i-1]);
+  }
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse2")))
+static void TransformLayerSSE2(const LayerTemplate &t,
+                               double cos_angle, double sin_angle,
+                               const Vector2D &offset, double height,
+                               const Vector2D &start, double start_z,
+                               LayerPath *out) {
+  const size_t n = t.size();
+  const size_t padded = t.x.padded_size();
+  const __m128d c = _mm_set1_pd(cos_angle);
+  const __m128d s = _mm_set1_pd(sin_angle);
+  const __m128d ox = _mm_set1_pd(offset.x);
+  const __m128d oy = _mm_set1_pd(offset.y);
+  const __m128d h = _mm_set1_pd(height);
+  for (size_t i = 0; i < padded; i += 2) {
+    const __m128d tx = _mm_load_pd(t.x.data() + i);
+    const __m128d ty = _mm_load_pd(t.y.data() + i);
+    const __m128d x = _mm_sub_pd(_mm_mul_pd(tx, c), _mm_mul_pd(ty, s));
+    const __m128d y = _mm_add_pd(_mm_mul_pd(ty, c), _mm_mul_pd(tx, s));
+    _mm_store_pd(out->x.data() + i, _mm_add_pd(x, ox));
+    _mm_store_pd(out->y.data() + i, _mm_add_pd(y, oy));
+    _mm_store_pd(out->z.data() + i,
+                 _mm_add_pd(h, _mm_load_pd(t.z_ramp.data() + i)));
+  }
+  FirstSegment(start, start_z, out);
+  size_t i = 1;
+  for (/**/; i + 2 <= n; i += 2) {
+    const __m128d dx = _mm_sub_pd(_mm_loadu_pd(out->x.data() + i),
+                                  _mm_loadu_pd(out->x.data() + i - 1));
+    const __m128d dy = _mm_sub_pd(_mm_loadu_pd(out->y.data() + i),
+                                  _mm_loadu_pd(out->y.data() + i - 1));
+    const __m128d dz = _mm_sub_pd(_mm_loadu_pd(out->z.data() + i),
+                                  _mm_loadu_pd(out->z.data() + i - 1));
+    const __m128d sum = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx),
+                                              _mm_mul_pd(dy, dy)),
+                                   _mm_mul_pd(dz, dz));
+    _mm_storeu_pd(out->segment_len.data() + i, _mm_sqrt_pd(sum));
+  }
+  for (/**/; i < n; ++i) {
+    out->segment_len[i] = distance(out->x[i] - out->x[i-1],
+                                   out->y[i] - out->y[i-1],
+                                   out->z[i] - out->z[i-1]);
+  }
+}
+
+__attribute__((target("avx2")))
+static void TransformLayerAVX2(const LayerTemplate &t,
+                               double cos_angle, double sin_angle,
+                               const Vector2D &offset, double height,
+                               const Vector2D &start, double start_z,
+                               LayerPath *out) {
+  const size_t n = t.size();
+  const size_t padded = t.x.padded_size();
+  const __m256d c = _mm256_set1_pd(cos_angle);
+  const __m256d s = _mm256_set1_pd(sin_angle);
+  const __m256d ox = _mm256_set1_pd(offset.x);
+  const __m256d oy = _mm256_set1_pd(offset.y);
+  const __m256d h = _mm256_set1_pd(height);
+  for (size_t i = 0; i < padded; i += 4) {
+    const __m256d tx = _mm256_load_pd(t.x.data() + i);
+    const __m256d ty = _mm256_load_pd(t.y.data() + i);
+    const __m256d x = _mm256_sub_pd(_mm256_mul_pd(tx, c),
+                                    _mm256_mul_pd(ty, s));
+    const __m256d y = _mm256_add_pd(_mm256_mul_pd(ty, c),
+                                    _mm256_mul_pd(tx, s));
+    _mm256_store_pd(out->x.data() + i, _mm256_add_pd(x, ox));
+    _mm256_store_pd(out->y.data() + i, _mm256_add_pd(y, oy));
+    _mm256_store_pd(out->z.data() + i,
+                    _mm256_add_pd(h, _mm256_load_pd(t.z_ramp.data() + i)));
+  }
+  FirstSegment(start, start_z, out);
+  size_t i = 1;
+  for (/**/; i + 4 <= n; i += 4) {
+    const __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(out->x.data() + i),
+                                     _mm256_loadu_pd(out->x.data() + i - 1));
+    const __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(out->y.data() + i),
+                                     _mm256_loadu_pd(out->y.data() + i - 1));
+    const __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(out->z.data() + i),
+                                     _mm256_loadu_pd(out->z.data() + i - 1));
+    const __m256d sum = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx),
+                                                    _mm256_mul_pd(dy, dy)),
+                                      _mm256_mul_pd(dz, dz));
+    _mm256_storeu_pd(out->segment_len.data() + i, _mm256_sqrt_pd(sum));
+  }
+  for (/**/; i < n; ++i) {
+    out->segment_len[i] = distance(out->x[i] - out->x[i-1],
+                                   out->y[i] - out->y[i-1],
+                                   out->z[i] - out->z[i-1]);
+  }
+}
+#endif  // HAVE_X86_KERNELS
+
+namespace {
+typedef void (*TransformFun)(const LayerTemplate &, double, double,
+                             const Vector2D &, double,
+                             const Vector2D &, double, LayerPath *);
+struct Implementation {
+  TransformFun fun;
+  const char *name;
+};
+
+Implementation ChooseImplementation() {
+  if (getenv("SHELL_EXTRUDE_NO_SIMD") != NULL)
+    return { TransformLayerScalar, "scalar" };
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return { TransformLayerAVX2, "avx2" };
+  if (__builtin_cpu_supports("sse2"))
+    return { TransformLayerSSE2, "sse2" };
+#endif
+  return { TransformLayerScalar, "scalar" };
+}
+
+const Implementation &GetImplementation() {
+  static const Implementation implementation = ChooseImplementation();
+  return implementation;
+}
+}  // namespace
+
+void TransformLayer(const LayerTemplate &t, double cos_angle, double sin_angle,
+                    const Vector2D &offset, double height,
+                    const Vector2D &start, double start_z, LayerPath *out) {
+  out->resize(t.size());
+  GetImplementation().fun(t, cos_angle, sin_angle, offset, height,
+                          start, start_z, out);
+}
+
+const char *TransformLayerImplementation() {
+  return GetImplementation().name;
+}
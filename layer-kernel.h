@@ -0,0 +1,76 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_LAYER_KERNEL_H_
+#define SHELL_EXTRUDE_LAYER_KERNEL_H_
+
+#include <stddef.h>
+
+#include "multi-shell-extrude.h"
+
+// Array of doubles, aligned and padded to a multiple of kPadding elements
+// so that the SIMD kernels can always work on full vectors.
+class DoubleArray {
+public:
+  static const size_t kPadding = 4;   // 4 doubles: AVX register.
+
+  DoubleArray() : data_(NULL), size_(0), capacity_(0) {}
+  ~DoubleArray();
+
+  // Resize; previous content is not preserved. Padding is zero.
+  void resize(size_t size);
+  size_t size() const { return size_; }
+  size_t padded_size() const { return (size_ + kPadding - 1) & ~(kPadding - 1); }
+
+  double *data() { return data_; }
+  const double *data() const { return data_; }
+  double &operator[](size_t i) { return data_[i]; }
+  double operator[](size_t i) const { return data_[i]; }
+
+private:
+  DoubleArray(const DoubleArray &);   // Not copyable.
+  void operator=(const DoubleArray &);
+
+  double *data_;
+  size_t size_;
+  size_t capacity_;
+};
+
+// Everything in a layer of the extrusion that is the same for each layer,
+// in structure-of-arrays layout.
+// A layer is the template rotated by the layer angle, lifted to the layer
+// height; so no trigonometry or distance calculation per vertex and layer.
+struct LayerTemplate {
+  void resize(size_t size) { x.resize(size); y.resize(size); z_ramp.resize(size); }
+  size_t size() const { return x.size(); }
+
+  // Polygon vertices, each already rotated by the fraction of the
+  // rotation-per-layer it is in the layer.
+  DoubleArray x, y;
+  DoubleArray z_ramp;  // Vertex height above the layer start height.
+};
+
+// Points of one layer, ready to be sent to the printer.
+struct LayerPath {
+  void resize(size_t size) {
+    x.resize(size); y.resize(size); z.resize(size); segment_len.resize(size);
+  }
+  size_t size() const { return x.size(); }
+
+  DoubleArray x, y, z;
+  DoubleArray segment_len;   // Length of segment from previous point.
+};
+
+// Transform the layer template: rotate by an angle (given as "cos_angle" and
+// "sin_angle"), translate by "offset" and lift to "height". The segment
+// length of the first point is relative to "start" at "start_z".
+// Uses AVX2 or SSE2 if available on this CPU.
+void TransformLayer(const LayerTemplate &t, double cos_angle, double sin_angle,
+                    const Vector2D &offset, double height,
+                    const Vector2D &start, double start_z, LayerPath *out);
+
+// Name of the implementation TransformLayer() uses on this CPU.
+const char *TransformLayerImplementation();
+
+#endif  // SHELL_EXTRUDE_LAYER_KERNEL_H_
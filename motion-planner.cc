@@ -0,0 +1,165 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "motion-planner.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <limits>
+
+MotionPlanner::MotionPlanner(const MotionLimits &limits)
+  : limits_(limits), x_(0), y_(0), z_(0), dir_x_(0), dir_y_(0), dir_z_(0),
+    last_speed_(0), time_(0), stopped_(false), head_time_(0) {
+}
+
+void MotionPlanner::MoveTo(double x, double y, double z, double feedrate) {
+  if (!stopped_) {
+    const Target target = { x, y, z, feedrate };
+    head_.push_back(target);
+  }
+  const double dx = x - x_, dy = y - y_, dz = z - z_;
+  const double length = sqrt(dx*dx + dy*dy + dz*dz);
+  x_ = x; y_ = y; z_ = z;
+  if (length < 1e-6 || feedrate <= 0)
+    return;   // Not a move the firmware would need time for.
+  const double dir_x = dx / length, dir_y = dy / length, dir_z = dz / length;
+
+  Block block;
+  block.length = length;
+  block.nominal_speed = feedrate;
+  block.max_entry_speed = 0;
+  if (last_speed_ > 0) {
+    block.max_entry_speed = std::min(std::min(feedrate, last_speed_),
+                                     JunctionSpeed(dir_x, dir_y, dir_z));
+  }
+  block.entry_speed = 0;   // Determined in Recalculate().
+  block.stop_speed = -1;
+  blocks_.push_back(block);
+  dir_x_ = dir_x; dir_y_ = dir_y; dir_z_ = dir_z;
+  last_speed_ = feedrate;
+
+  Recalculate();
+  // Moves that are not in the buffer anymore are done: their speeds can't
+  // change anymore.
+  while ((int)blocks_.size() > std::max(limits_.buffer_size, 1)) {
+    time_ += BlockTime(blocks_[0], blocks_[1].entry_speed);
+    blocks_.pop_front();
+  }
+}
+
+void MotionPlanner::Stop() {
+  time_ = GetTime();
+  blocks_.clear();
+  last_speed_ = 0;
+  if (!stopped_) {
+    stopped_ = true;
+    head_time_ = time_;
+  }
+}
+
+double MotionPlanner::GetTime() const {
+  double result = time_;
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    result += BlockTime(blocks_[i], (i + 1 < blocks_.size())
+                        ? blocks_[i+1].entry_speed
+                        : 0);
+  }
+  return result;
+}
+
+void MotionPlanner::Append(const MotionPlanner &other) {
+  for (const Target &target : other.head_) {
+    MoveTo(target.x, target.y, target.z, target.feedrate);
+  }
+  if (!other.stopped_)
+    return;
+  // After a stop, nothing depends on what happened before, so we can just
+  // continue in the state of "other".
+  Stop();
+  time_ += other.time_ - other.head_time_;
+  x_ = other.x_; y_ = other.y_; z_ = other.z_;
+  dir_x_ = other.dir_x_; dir_y_ = other.dir_y_; dir_z_ = other.dir_z_;
+  last_speed_ = other.last_speed_;
+  blocks_ = other.blocks_;
+}
+
+// Maximum speed at the junction from the last move to a move in the given
+// direction.
+double MotionPlanner::JunctionSpeed(double dx, double dy, double dz) const {
+  if (limits_.junction_deviation > 0) {
+    // Speed at which the centripetal acceleration on a circle, that touches
+    // both moves "junction_deviation" away from the corner, is the
+    // configured acceleration.
+    const double cos_theta = -(dx * dir_x_ + dy * dir_y_ + dz * dir_z_);
+    if (cos_theta > 0.999999)
+      return 0;   // Reversal.
+    if (cos_theta < -0.999999)
+      return std::numeric_limits<double>::max();   // Straight.
+    const double sin_theta_half = sqrt(0.5 * (1 - cos_theta));
+    return sqrt(limits_.acceleration * limits_.junction_deviation
+                * sin_theta_half / (1 - sin_theta_half));
+  }
+  // Speed at which the change of the velocity vector is the jerk.
+  const double change = sqrt((dx - dir_x_) * (dx - dir_x_)
+                             + (dy - dir_y_) * (dy - dir_y_)
+                             + (dz - dir_z_) * (dz - dir_z_));
+  if (change < 1e-9)
+    return std::numeric_limits<double>::max();
+  return limits_.jerk / change;
+}
+
+// Determine the entry speeds of all blocks in the buffer after a new one
+// has been added. The first block is already being executed, so its entry
+// speed is fixed.
+void MotionPlanner::Recalculate() {
+  const double two_accel = 2 * limits_.acceleration;
+  const int n = blocks_.size();
+  // Backwards: we need to be able to stop at the end of the last block.
+  // Once a stop speed is the same as before, all the ones before are as
+  // well; usually that is only a few blocks back, where the speed is
+  // limited by the junction.
+  int first_changed = 1;
+  double next_stop_speed = 0;
+  for (int i = n - 1; i > 0; --i) {
+    Block &block = blocks_[i];
+    const double stop_speed = std::min(block.max_entry_speed,
+                                       sqrt(next_stop_speed * next_stop_speed
+                                            + two_accel * block.length));
+    if (stop_speed == block.stop_speed) {
+      first_changed = i + 1;
+      break;
+    }
+    block.stop_speed = stop_speed;
+    next_stop_speed = stop_speed;
+  }
+  // Forward: we can't accelerate more than possible within a block.
+  for (int i = first_changed; i < n; ++i) {
+    const Block &prev = blocks_[i-1];
+    blocks_[i].entry_speed = std::min(blocks_[i].stop_speed,
+                                      sqrt(prev.entry_speed * prev.entry_speed
+                                           + two_accel * prev.length));
+  }
+}
+
+// Time for a block with trapezoidal speed profile: accelerate from the entry
+// speed, cruise at nominal speed, decelerate to the "exit_speed".
+double MotionPlanner::BlockTime(const Block &block, double exit_speed) const {
+  const double accel = limits_.acceleration;
+  const double v0 = block.entry_speed;
+  const double v1 = exit_speed;
+  const double vn = std::max(block.nominal_speed, std::max(v0, v1));
+  const double accel_dist = (vn * vn - v0 * v0) / (2 * accel);
+  const double decel_dist = (vn * vn - v1 * v1) / (2 * accel);
+  if (accel_dist + decel_dist <= block.length) {
+    return ((vn - v0) + (vn - v1)) / accel
+      + (block.length - accel_dist - decel_dist) / vn;
+  }
+  // Nominal speed not reached; triangle profile.
+  const double peak = sqrt(accel * block.length + (v0 * v0 + v1 * v1) / 2);
+  if (peak < std::max(v0, v1))
+    return 2 * block.length / (v0 + v1);   // Can't happen for planned blocks.
+  return ((peak - v0) + (peak - v1)) / accel;
+}
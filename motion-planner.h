@@ -0,0 +1,73 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_MOTION_PLANNER_H_
+#define SHELL_EXTRUDE_MOTION_PLANNER_H_
+
+#include <deque>
+#include <vector>
+
+// What the printer firmware does to plan moves.
+struct MotionLimits {
+  double acceleration;         // mm/s²
+  double jerk;                 // mm/s speed change allowed at corners.
+  double junction_deviation;   // mm. If > 0, used instead of jerk.
+  int buffer_size;             // Number of moves the firmware plans ahead.
+};
+
+// Simulation of a printer's motion planner to estimate the print time.
+// Moves have a trapezoidal speed profile with constant acceleration. The
+// speed at the junction between moves is limited by the jerk or junction
+// deviation, and such that the printer can come to a stop at the end of the
+// moves it knows about - the last in its planner buffer.
+class MotionPlanner {
+public:
+  explicit MotionPlanner(const MotionLimits &limits);
+
+  // Move to the absolute position with "feedrate" in mm/s.
+  void MoveTo(double x, double y, double z, double feedrate);
+
+  // Come to a full stop, e.g. for moves that only involve the extruder.
+  void Stop();
+
+  // Time in seconds for all moves so far. Moves still in the planner
+  // buffer are accounted as if the printer would stop after the last one.
+  double GetTime() const;
+
+  // Continue with the moves of "other", that were planned starting from
+  // rest at an arbitrary position. Moves up to the first Stop() in "other"
+  // are re-planned from our current position, so the result is the same as
+  // if all moves of "other" were given to us directly.
+  void Append(const MotionPlanner &other);
+
+private:
+  struct Target {
+    double x, y, z;
+    double feedrate;
+  };
+  struct Block {
+    double length;
+    double nominal_speed;
+    double max_entry_speed;
+    double stop_speed;    // Max entry speed to be able to stop in time.
+    double entry_speed;
+  };
+
+  double JunctionSpeed(double dx, double dy, double dz) const;
+  void Recalculate();
+  double BlockTime(const Block &block, double exit_speed) const;
+
+  const MotionLimits limits_;
+  double x_, y_, z_;          // Current position.
+  double dir_x_, dir_y_, dir_z_;   // Unit direction of the last move.
+  double last_speed_;          // Nominal speed of the last move; 0 if stopped.
+  std::deque<Block> blocks_;   // Planner buffer.
+  double time_;                // Time of moves that left the buffer.
+
+  bool stopped_;               // Stop() seen since start.
+  std::vector<Target> head_;   // Moves before the first Stop().
+  double head_time_;           // Time at the first Stop().
+};
+
+#endif  // SHELL_EXTRUDE_MOTION_PLANNER_H_
@@ -4,68 +4,83 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
 #include <vector>
 
 #include "multi-shell-extrude.h"
 #include "printer.h"
+#include "background-writer.h"
+#include "bed-layout.h"
 #include "config-values.h"
+#include "extrusion.h"
+#include "motion-planner.h"
+#include "output-buffer.h"
+#include "parallel.h"
+#include "stats.h"
+#include "toolpath.h"
 
-// The total length of distance going through a polygon.
-double CalcPolygonLen(const Polygon &polygon) {
-  double len = 0;
-  const int size = polygon.size();
-  for (int i = 1; i < size; ++i) {
-    len += distance(polygon[i].x - polygon[i-1].x,
-                    polygon[i].y - polygon[i-1].y, 0);
-  }
-  // Back to the beginning.
-  len += distance(polygon[size-1].x - polygon[0].x,
-                  polygon[size-1].y - polygon[0].y, 0);
-  return len;
-}
-
-// Get temperature for layer. Right now, this is a simple sin(), but
-// could be something more pleasingly erratic, such as Perlin noise.
-static float GetLayerTemperature(float base_temp, float variation,
-                                 float height, float noise_feature) {
-  return sin(2 * M_PI * height / noise_feature) * variation + base_temp;
+// Rings of the spiral of a bottom plate, from "outer_distance" to
+// "inner_distance" around the "target_polygon".
+static std::vector<Polygon> BottomPlateRings(const Polygon &target_polygon,
+                                             float outer_distance,
+                                             float inner_distance,
+                                             float spiral_distance, int jobs) {
+  std::vector<double> offsets;
+  for (float poffset = outer_distance;
+       poffset > inner_distance; poffset -= spiral_distance) {
+    offsets.push_back(poffset);
+  }
+  // These are filling rings, so the small error from deriving them from
+  // each other is acceptable.
+  return PolygonOffsetLadder(target_polygon, offsets, true, kOffsetRound,
+                             jobs);
 }
 
 static void CreateBottomPlate(const Polygon &target_polygon,
                               Printer *printer,
                               const Vector2D &center_offset,
                               float outer_distance, float inner_distance,
-                              float spiral_distance) {
+                              float spiral_distance, int jobs) {
   const float kBottomExtrusionMultiplier = 1.2;  // watertight
   bool is_first = true;
   // Initial height.
   const float z_height = spiral_distance/2;
   const Vector2D centroid = Centroid(target_polygon);
-  for (float poffset = outer_distance;
-       poffset > inner_distance; poffset -= spiral_distance) {
-    Polygon p = PolygonOffset(target_polygon, poffset);
+  const std::vector<Polygon> rings
+    = BottomPlateRings(target_polygon, outer_distance, inner_distance,
+                       spiral_distance, jobs);
+  for (const Polygon &p : rings) {
     if (p.size() == 0)
       return;   // Natural end of moving towards center.
     float run_len = 0;
     const float polygon_len = CalcPolygonLen(p);
     // fudging a spiral: we want that the distance from the center
     // is one spiral_distance less in the end.
-    float outer_distance = (p[0] - centroid).magnitude();
+    float outer_distance = (FromFixed(p[0]) - centroid).magnitude();
     for (int i = 0; i < (int) p.size(); ++i) {
       if (i == 0) {
         run_len = 0;
       } else {
-        run_len += (p[i] - p[i-1]).magnitude();
+        run_len += (FromFixed(p[i]) - FromFixed(p[i-1])).magnitude();
       }
-      Vector2D current_point_from_center = p[i] - centroid;
+      Vector2D current_point_from_center = FromFixed(p[i]) - centroid;
       const double fraction = run_len / polygon_len;
       float spiral_adjust = (outer_distance - fraction*spiral_distance)/outer_distance;
       current_point_from_center = current_point_from_center * spiral_adjust;
@@ -79,175 +94,74 @@ static void CreateBottomPlate(const Polygon &target_polygon,
   }
 }
 
-struct ExtrusionParams {
-  double feedrate;
-  double layer_height;
-  double total_height;
-  double rotation_per_mm;
-  double lock_offset;
-  double fan_on_height;
-  double elephant_foot_multiplier;
-  double first_layer_feedrate_multiplier;
-
-  float base_temp;
-  float temp_variation;
-};
-
-// Requires: Polygon with centroid on (0,0)
-static void CreateExtrusion(const Polygon &extrusion_polygon, Printer *printer,
-                            const Vector2D &center,
-                            const ExtrusionParams &params) {
-  printer->Comment("Center X=%.1f Y=%.1f\n", center.x, center.y);
-  printer->SetColor(0, 0, 0);
-  const float z_bottom_offset = params.layer_height / 2;
-  const double rotation_per_layer =
-      params.layer_height * params.rotation_per_mm * 2 * M_PI;
-  bool fan_is_on = false;
-  printer->SwitchFan(false);
-  double height = 0;
-  double angle = 0;
-  double run_len = 0;
-  const bool do_lock = (params.lock_offset > 0);
-  double polygon_len = 0;
-  Polygon p; // active polygon.
-  static const int kLockOverlap = 3;
-  enum State { START, WIDE_LOCK, NORMAL, NARROW_LOCK };
-  enum State state = START;
-  enum State prev_state;
-  for (height = 0, angle = 0; height < params.total_height;
-       height += params.layer_height, angle += rotation_per_layer) {
-    printer->SetTemperature(GetLayerTemperature(
-        params.base_temp, params.temp_variation, height, 30));
-    prev_state = state;
-
-    // Experimental. Locking screws do have smaller/larger diameter at their
-    // ends. This goes through the state transitions.
-    // What to print. For locking screw we're very simple: we just offset the
-    // polygon, but don't do any transition for now.
-    // TODO: re-arrange polygon to start at same angle.
-    switch (state) {
-    case START:
-      if (do_lock) {
-        state = WIDE_LOCK;
-        p = PolygonOffset(extrusion_polygon, params.lock_offset);
-      } else {
-        state = NORMAL;
-        p = extrusion_polygon;
-      }
-      break;
-
-    case WIDE_LOCK:
-      if (do_lock && height > kLockOverlap) {
-        p = extrusion_polygon;
-        state = NORMAL;
-      }
-      break;
-
-    case NORMAL:
-      if (do_lock && height > params.total_height - kLockOverlap) {
-        p = PolygonOffset(extrusion_polygon, -params.lock_offset);
-        state = NARROW_LOCK;
-      }
-      break;
-    case NARROW_LOCK: /* terminal state */
-      break;
-    }
-
-    if (state != prev_state) {
-      polygon_len = CalcPolygonLen(p);
-      // First move slowly, so that we wipe potential nozzle leak extrusion
-      printer->SetSpeed(std::min(params.feedrate / 3, 15.0));
-      printer->MoveTo(p[0] + center, height + z_bottom_offset);
-    }
-
-    for (int i = 0; i < (int)p.size(); ++i) {
-      if (i == 0) {
-        run_len = 0;
-      } else {
-        run_len += distance(p[i].x - p[i - 1].x, p[i].y - p[i - 1].y, 0);
-      }
-      const double fraction = run_len / polygon_len;
-      const double a = angle + fraction * rotation_per_layer;
-      const Vector2D point = rotate(p[i], a);
-      const double z = height + params.layer_height * fraction;
-      const bool is_initial_layers = z < 2 * params.layer_height;
-      // Speed: keep slow while initial layers, then lerp-ing up to full
-      // speed within 4 more layers
-      if (is_initial_layers) {
-        printer->SetSpeed(params.feedrate *
-                          params.first_layer_feedrate_multiplier);
-      } else if (z < 4 * params.layer_height) {
-        const double range = 1.0 - params.first_layer_feedrate_multiplier;
-        const double lerp = (z - 2 *  params.layer_height)
-          / ((4 - 2) * params.layer_height);
-        printer->SetSpeed(params.feedrate *
-                          (params.first_layer_feedrate_multiplier
-                           + lerp * range));
-      } else {
-        printer->SetSpeed(params.feedrate);
-      }
-      // Start only extruding when min z-offset reached and also stop extruding
-      // at the top to wipe off excess
-      if (z > z_bottom_offset / 2 &&
-          z < params.total_height - 0.30 * params.layer_height) {
-        printer->ExtrudeTo(point + center, z,
-                           (is_initial_layers)
-                           ? params.elephant_foot_multiplier
-                           : 1.0);
-      } else {
-        // In the last layer, we stop extruding to have a smooth finish.
-        printer->MoveTo(point + center, z);
-      }
-    }
-
-    if (height > params.fan_on_height && !fan_is_on) {
-      printer->SwitchFan(true); // reached fan-on height: switch on.
-      fan_is_on = true;
-    }
+// Extrusion distance of CreateBottomPlate(), from the length of the rings.
+// Each ring is a turn of the spiral that gets closer to the centroid by the
+// "spiral_distance", so it is shorter by the ratio of that.
+static double EstimateBottomPlate(const Polygon &target_polygon,
+                                  float outer_distance, float inner_distance,
+                                  float spiral_distance, int jobs) {
+  const Vector2D centroid = Centroid(target_polygon);
+  const std::vector<Polygon> rings
+    = BottomPlateRings(target_polygon, outer_distance, inner_distance,
+                       spiral_distance, jobs);
+  double result = 0;
+  Vector2D last_pos;
+  for (size_t r = 0; r < rings.size() && !rings[r].empty(); ++r) {
+    const Polygon &p = rings[r];
+    const Vector2D start = FromFixed(p[0]);
+    const Vector2D end = FromFixed(p.back());
+    const double polygon_len = CalcPolygonLen(p);
+    const double outer = (start - centroid).magnitude();
+    // The ring goes from the first to the last vertex, then on to the next.
+    const double ring_len = polygon_len - (start - end).magnitude();
+    const double fraction = ring_len / polygon_len;
+    if (r > 0) result += (start - last_pos).magnitude();
+    result += ring_len * (1 - fraction * spiral_distance / (2 * outer));
+    last_pos = centroid
+      + (end - centroid) * ((outer - fraction * spiral_distance) / outer);
   }
+  return result;
 }
 
 Polygon OffsetCenter(const Polygon& polygon, double x_offset, double y_offset) {
+  const FixedPoint offset = ToFixed(Vector2D(x_offset, y_offset));
   Polygon result;
-  for (const Vector2D &p : polygon) {
-    result.push_back(Vector2D(p.x + x_offset, p.y + y_offset));
+  for (const FixedPoint &p : polygon) {
+    result.push_back(FixedPoint(p.x + offset.x, p.y + offset.y));
   }
   return result;
 }
 
-// Read very simple polygon from file: essentially a sequence of x y
-// coordinates.
-Polygon ReadPolygon(const std::string &filename, double factor) {
-  Polygon polygon;
-  FILE *in = fopen(filename.c_str(), "r");
-  if (!in) {
-    fprintf(stderr, "Can't open %s\n", filename.c_str());
-    return polygon;
+// Base polygons by a "key" describing everything they depend on. If not
+// known yet, "create" is called to get it.
+// Like the offset cache, bounded by the number of vertices: a sweep over
+// the size of a large polygon file would otherwise keep all of them.
+static Polygon CachedPolygon(const std::string &key,
+                             const std::function<Polygon()> &create) {
+  static const size_t kMaxVertices = 1 << 20;   // 16 bytes each, so 16MB.
+  static std::mutex mutex;
+  static std::map<std::string, Polygon> polygons;
+  static size_t vertices = 0;
+  {
+    std::lock_guard<std::mutex> l(mutex);
+    const std::map<std::string, Polygon>::const_iterator found
+      = polygons.find(key);
+    if (found != polygons.end())
+      return found->second;
   }
-  char buffer[256];
-  int line = 0;
-  while (fgets(buffer, sizeof(buffer), in)) {
-    ++line;
-    const char *start = buffer;
-    while (*start && isspace(*start))
-      start++;
-    if (*start == '\0' || *start == '#')
-      continue;
-    Vector2D p;
-    if (sscanf(start, "%lf %lf", &p.x, &p.y) == 2) {
-      p.x *= factor;
-      p.y *= factor;
-      polygon.push_back(p);
-    } else {
-      for (char *end = buffer + strlen(buffer) - 1; isspace(*end); end--) {
-        *end = '\0';
-      }
-      fprintf(stderr, "%s:%d not a comment and not coordinates: '%s'\n",
-              filename.c_str(), line, start);
-    }
+  const Polygon result = create();
+  if (result.size() > kMaxVertices)
+    return result;   // Would push out everything else.
+  std::lock_guard<std::mutex> l(mutex);
+  if (polygons.count(key))
+    return result;   // Created by another thread in the meantime.
+  if (vertices + result.size() > kMaxVertices) {
+    polygons.clear();  // Simple way to keep memory bounded.
+    vertices = 0;
   }
-  fclose(in);
-  return polygon;
+  polygons[key] = result;
+  vertices += result.size();
+  return result;
 }
 
 // Pump a polygon as if it was not arranged a dot but a circle of radius pump_r
@@ -255,10 +169,11 @@ Polygon RadialPumpPolygon(const Polygon& polygon, double pump_r) {
   if (pump_r <= 0)
     return polygon;
   Polygon result;
-  for (const Vector2D &p : polygon) {
+  for (const FixedPoint &fixed_point : polygon) {
+    const Vector2D p = FromFixed(fixed_point);
     double from_center = distance(p.x, p.y, 0);
     double stretch = (from_center + pump_r) / from_center;
-    result.push_back(Vector2D(p.x * stretch, p.y * stretch));
+    result.push_back(ToFixed(Vector2D(p.x * stretch, p.y * stretch)));
   }
   return result;
 }
@@ -267,19 +182,402 @@ Polygon RadialPumpPolygon(const Polygon& polygon, double pump_r) {
 double GetRadius(const Polygon &polygon) {
   double dist = -1;
   for (size_t i = 0; i < polygon.size(); ++i) {
-    dist = std::max(dist, distance(polygon[i].x, polygon[i].y, 0));
+    dist = std::max(dist, distance(FromFixed(polygon[i].x),
+                                   FromFixed(polygon[i].y), 0));
   }
   return dist;
 }
 
-int main(int argc, char *argv[]) {
+Box GetBoundingBox(const Polygon &polygon) {
+  Box result = { FromFixed(polygon[0]), FromFixed(polygon[0]) };
+  for (const FixedPoint &fixed_point : polygon) {
+    const Vector2D p = FromFixed(fixed_point);
+    result.min = Vector2D(std::min(result.min.x, p.x),
+                          std::min(result.min.y, p.y));
+    result.max = Vector2D(std::max(result.max.x, p.x),
+                          std::max(result.max.y, p.y));
+  }
+  return result;
+}
+
+// A screw as planned on the bed.
+struct Screw {
+  int index;
+  float offset;
+  Polygon polygon;   // Empty if offset does not leave anything to print.
+  double radius;
+  Vector2D center;
+};
+
+// Parameters common to all screws.
+struct ScrewParams {
+  ExtrusionParams extrusion;   // Feedrate is determined per screw.
+  float feed_mm_per_sec;
+  float min_layer_time;
+  float total_height;
+  float hover_pos;       // Hovering over screws while moving
+  bool vessel;
+  float vessel_hole;
+  float brim;
+  float brim_spiral_distance;
+  float brim_smooth_radius;
+  int offset_jobs;    // Threads to use for polygon offsets.
+  Stats *stats;       // Time spent in phases; NULL if not measured.
+};
+
+struct ScrewResult {
+  double travel;   // Extrusion distance
+  int flow_limited_moves;
+  double time;     // Estimated print time in seconds.
+  std::vector<float> layer_time;   // Estimated time of each layer.
+  float area;
+  int segments_removed;   // By decimation.
+};
+
+// Polygon the brim goes around.
+static Polygon BrimPolygon(const Polygon &polygon, const ScrewParams &params) {
+  if (params.brim_smooth_radius <= 0)
+    return polygon;
+  ScopedPhase phase(params.stats, Stats::kOffset);
+  return PolygonOffset(PolygonOffset(polygon, params.brim_smooth_radius), -params.brim_smooth_radius);
+}
+
+static ScrewResult CreateScrew(const Screw &screw, const ScrewParams &params,
+                               Printer *printer) {
+  const Polygon &polygon = screw.polygon;
+  const Vector2D &center = screw.center;
+  printer->MoveTo(center, screw.index > 0
+                  ? params.total_height + params.hover_pos
+                  : params.hover_pos);
+  const float polygon_len = CalcPolygonLen(polygon);
+  ScrewResult result;
+  result.area = polygon_len * params.total_height * 2;  // inside and out.
+  float layer_feedrate =  polygon_len / params.min_layer_time;
+  layer_feedrate = std::min(layer_feedrate, params.feed_mm_per_sec);
+  printer->ResetExtrude();
+  // The printer is at rest after each ResetExtrude() and Retract(), so
+  // the time in between does not depend on what was printed before.
+  const double start_time = printer->GetPrintTime();
+  const int start_flow_limited = printer->GetFlowLimitedMoves();
+  printer->SetSpeed(layer_feedrate);
+  printer->Comment("Screw #%d, polygon-offset=%.1f\n",
+                   screw.index+1, screw.offset);
+  if (params.vessel) {
+    printer->Comment("Create vessel-bottom\n");
+    printer->SetColor(0.5, 0, 0.5);
+    printer->SetSpeed(params.feed_mm_per_sec / 2);
+    ScopedPhase phase(params.stats, Stats::kBottomPlate);
+    CreateBottomPlate(polygon, printer, center,
+                      0, -screw.radius + params.vessel_hole,
+                      params.brim_spiral_distance, params.offset_jobs);
+    // TODO: make this multi-layer.
+    printer->GoZPos(2);
+  }
+
+  if (params.brim > 0) {
+    const float spiral_layer_distance = params.brim_spiral_distance;
+    int layers = (int) ceil(params.brim / spiral_layer_distance);
+    const Polygon brim_polygon = BrimPolygon(polygon, params);
+    printer->Comment("Create brim\n");
+    printer->SetColor(0, 0.5, 0);
+    printer->SetSpeed(params.feed_mm_per_sec / 2);
+    ScopedPhase phase(params.stats, Stats::kBottomPlate);
+    CreateBottomPlate(brim_polygon, printer, center,
+                      layers * spiral_layer_distance, spiral_layer_distance/2,
+                      spiral_layer_distance, params.offset_jobs);
+  }
+  ExtrusionParams extrusion_params = params.extrusion;
+  extrusion_params.feedrate = layer_feedrate;
+  {
+    ScopedPhase phase(params.stats, Stats::kExtrusion);
+    result.segments_removed = CreateExtrusion(polygon, printer, center,
+                                              extrusion_params,
+                                              &result.layer_time);
+  }
+  result.travel = printer->GetExtrusionDistance();  // since last reset.
+  result.flow_limited_moves
+    = printer->GetFlowLimitedMoves() - start_flow_limited;
+  printer->SetSpeed(params.feed_mm_per_sec);
+  printer->Retract();
+  result.time = printer->GetPrintTime() - start_time;
+  printer->GoZPos(params.total_height + params.hover_pos);
+  return result;
+}
+
+// Time to move "distance" from standstill to standstill at "feedrate" with
+// "acceleration".
+static double TravelTime(double distance, double feedrate,
+                         double acceleration) {
+  if (distance <= 0)
+    return 0;
+  if (distance < feedrate * feedrate / acceleration)
+    return 2 * sqrt(distance / acceleration);   // Never reaches feedrate.
+  return distance / feedrate + feedrate / acceleration;
+}
+
+// Estimate of CreateScrew(), without creating the toolpath: the extrusion
+// from its layers, the vessel bottom and brim from their rings at the speed
+// they are printed with.
+static ScrewResult EstimateScrew(const Screw &screw,
+                                 const ScrewParams &params) {
+  const Polygon &polygon = screw.polygon;
+  const float polygon_len = CalcPolygonLen(polygon);
+  ScrewResult result;
+  result.area = polygon_len * params.total_height * 2;  // inside and out.
+  float layer_feedrate =  polygon_len / params.min_layer_time;
+  layer_feedrate = std::min(layer_feedrate, params.feed_mm_per_sec);
+  const double acceleration = params.extrusion.motion_limits.acceleration;
+  const double bottom_feedrate = params.feed_mm_per_sec / 2;
+  double bottom_plate = 0;
+  if (params.vessel) {
+    ScopedPhase phase(params.stats, Stats::kBottomPlate);
+    bottom_plate += EstimateBottomPlate(polygon,
+                                        0, -screw.radius + params.vessel_hole,
+                                        params.brim_spiral_distance,
+                                        params.offset_jobs);
+  }
+  if (params.brim > 0) {
+    const float spiral_layer_distance = params.brim_spiral_distance;
+    int layers = (int) ceil(params.brim / spiral_layer_distance);
+    const Polygon brim_polygon = BrimPolygon(polygon, params);
+    ScopedPhase phase(params.stats, Stats::kBottomPlate);
+    bottom_plate += EstimateBottomPlate(brim_polygon,
+                                        layers * spiral_layer_distance,
+                                        spiral_layer_distance/2,
+                                        spiral_layer_distance,
+                                        params.offset_jobs);
+  }
+  // Going down from hovering to the start, slowly for the extrusion.
+  const double hover = screw.index > 0
+    ? params.total_height + params.hover_pos
+    : params.hover_pos;
+  const double down_feedrate = (params.vessel || params.brim > 0)
+    ? bottom_feedrate : std::min(layer_feedrate / 3, 15.0f);
+  ExtrusionParams extrusion_params = params.extrusion;
+  extrusion_params.feedrate = layer_feedrate;
+  ScopedPhase phase(params.stats, Stats::kExtrusion);
+  const ExtrusionEstimate extrusion
+    = EstimateExtrusion(polygon, extrusion_params, &result.layer_time);
+  result.travel = bottom_plate + extrusion.distance;
+  result.flow_limited_moves = 0;
+  result.segments_removed = extrusion.segments_removed;
+  result.time = (TravelTime(hover, down_feedrate, acceleration)
+                 + bottom_plate / bottom_feedrate);
+  for (float t : result.layer_time) {
+    result.time += t;
+  }
+  return result;
+}
+
+// Create screws in parallel, each on a detached printer. The output is then
+// appended in order to "printer", so it is the same as when creating them one
+// after another.
+// All screws start from the same printer state. If it turns out that the
+// printer state after a screw differs from that (e.g. due to temperature
+// variation), the remaining screws are re-done starting from the new state;
+// usually that state is then the same for all following screws.
+static void CreateScrewsParallel(const std::vector<Screw> &screws,
+                                 const ScrewParams &params, int jobs,
+                                 Printer *printer,
+                                 std::vector<ScrewResult> *results) {
+  const int count = screws.size();
+  std::vector<Printer*> detached(count, (Printer*) NULL);
+  int next = 0;  // Next screw to append to output.
+  while (next < count) {
+    Printer *const start_state = printer->CreateDetached();
+    const int first = next;
+    ParallelFor(count - first, jobs, [&](int i) {
+        const Screw &screw = screws[first + i];
+        if (screw.polygon.empty()) return;
+        detached[first + i] = start_state->CreateDetached();
+        (*results)[first + i] = CreateScrew(screw, params,
+                                            detached[first + i]);
+      });
+    for (/**/; next < count; ++next) {
+      if (!detached[next]) continue;
+      if (!printer->SameState(*start_state)) break;  // Need another round.
+      ScopedPhase phase(params.stats, Stats::kOutput);
+      printer->AppendDetached(*detached[next]);
+    }
+    for (int i = first; i < count; ++i) {
+      delete detached[i];
+      detached[i] = NULL;
+    }
+    delete start_state;
+  }
+}
+
+// Screws printed together on one bed, and into one output file.
+struct Bed {
+  std::vector<Screw> screws;
+  std::vector<ScrewResult> results;
+  double time;   // Estimated print time in seconds.
+  std::string filename;
+  std::string preview_filename;   // --also-postscript
+};
+
+// Relative deviation of --estimate from the full run, for typical prints.
+static const double kEstimateFilamentTolerance = 0.01;
+static const double kEstimateTimeTolerance = 0.05;
+
+// Estimate of printing the screws of "bed" without creating the toolpath:
+// the screws and the moves between them, not including the start-up of the
+// printer.
+static void EstimateBed(const ScrewParams &params, Bed *bed) {
+  const std::vector<Screw> &screws = bed->screws;
+  const double acceleration = params.extrusion.motion_limits.acceleration;
+  bed->results.resize(screws.size());
+  bed->time = 0;
+  const Screw *previous = NULL;
+  for (size_t i = 0; i < screws.size(); ++i) {
+    if (screws[i].polygon.empty()) continue;
+    if (previous) {
+      bed->time += TravelTime((screws[i].center - previous->center).magnitude(),
+                              params.feed_mm_per_sec, acceleration);
+    }
+    bed->results[i] = EstimateScrew(screws[i], params);
+    // .. and up again to hover over the screws.
+    bed->time += bed->results[i].time
+      + TravelTime(params.hover_pos, params.feed_mm_per_sec, acceleration);
+    previous = &screws[i];
+  }
+}
+
+// Filename for bed number "n": "out.gcode" becomes "out.bed<n>.gcode".
+static std::string BedFilename(const std::string &filename, int n) {
+  const size_t slash = filename.find_last_of('/');
+  size_t dot = filename.find_last_of('.');
+  if (dot == std::string::npos
+      || (slash != std::string::npos && dot < slash)) {
+    dot = filename.length();
+  }
+  return filename.substr(0, dot) + ".bed" + std::to_string(n)
+    + filename.substr(dot);
+}
+
+// Write the PostScript preview of "toolpath" to "filename".
+static bool WritePreview(const Toolpath &toolpath, const std::string &filename,
+                         double line_thickness, FILE *log) {
+  const int fd = open(filename.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(log, "%s: %s\n", filename.c_str(), strerror(errno));
+    return false;
+  }
+  BackgroundWriter writer(fd);
+  Printer *const printer = CreatePostscriptPrinter(new OutputBuffer(&writer),
+                                                   true, line_thickness);
+  toolpath.Replay(printer);
+  delete printer;
+  writer.Finish();
+  close(fd);
+  if (writer.error() != 0) {
+    fprintf(log, "%s: %s\n", filename.c_str(), strerror(writer.error()));
+    return false;
+  }
+  return true;
+}
+
+// Rough estimate of the output size, to be used to preallocate the output
+// file.
+static int64_t EstimateOutputSize(const std::vector<Screw> &screws,
+                                  float total_height, float layer_height,
+                                  int bytes_per_vertex) {
+  const int64_t layers = ceil(total_height / layer_height);
+  int64_t result = 64 << 10;  // Headers, preamble and such.
+  for (const Screw &screw : screws) {
+    result += layers * screw.polygon.size() * bytes_per_vertex;
+  }
+  return result;
+}
+
+// Print the estimate of "beds" as JSON to "out".
+static void PrintEstimate(const std::vector<Bed> &beds, int screw_count,
+                          double filament_extrusion_factor, FILE *out) {
+  double total_travel = 0;
+  double total_time = 0;
+  int placed = 0;
+  fprintf(out, "{\n  \"beds\": [");
+  for (size_t b = 0; b < beds.size(); ++b) {
+    const Bed &bed = beds[b];
+    fprintf(out, "%s\n    { ", b > 0 ? "," : "");
+    if (!bed.filename.empty()) {
+      fprintf(out, "\"file\": %s, ", JsonString(bed.filename).c_str());
+    }
+    fprintf(out, "\"time_s\": %.0f, \"screws\": [", bed.time);
+    bool first = true;
+    for (size_t i = 0; i < bed.screws.size(); ++i) {
+      const Screw &screw = bed.screws[i];
+      if (screw.polygon.empty()) continue;
+      const ScrewResult &result = bed.results[i];
+      fprintf(out, "%s\n      { \"offset\": %.2f, \"x\": %.1f, \"y\": %.1f, "
+              "\"layers\": %d, \"filament_m\": %.3f, \"time_s\": %.0f }",
+              first ? "" : ",", screw.offset, screw.center.x, screw.center.y,
+              (int)result.layer_time.size(),
+              result.travel * filament_extrusion_factor / 1000, result.time);
+      first = false;
+      total_travel += result.travel;
+      ++placed;
+    }
+    fprintf(out, " ] }");
+    total_time += bed.time;
+  }
+  fprintf(out, "\n  ],\n");
+  fprintf(out, "  \"screws\": %d,\n  \"screws_placed\": %d,\n",
+          screw_count, placed);
+  fprintf(out, "  \"filament_m\": %.3f,\n  \"time_s\": %.0f,\n",
+          total_travel * filament_extrusion_factor / 1000, total_time);
+  // Deviation from the full run, see EstimateExtrusion().
+  fprintf(out, "  \"tolerance\": { \"filament\": %.2f, \"time\": %.2f }\n}\n",
+          kEstimateFilamentTolerance, kEstimateTimeTolerance);
+}
+
+// Format duration as hh:mm:ss
+static std::string FormatTime(double seconds) {
+  int t = (int)seconds;
+  const int hours = t / 3600;
+  t %= 3600;
+  const int minutes = t / 60;
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%02d:%02d:%02d", hours, minutes, t % 60);
+  return buffer;
+}
+
+// Allocate "size" bytes of file "fd" from "offset" on. With "keep_size",
+// the file size is not changed, as the space is only filled as we write.
+static void PreallocateFile(int fd, off_t offset, int64_t size,
+                            bool keep_size) {
+#ifdef __linux__
+  // Unlike posix_fallocate(), this does not fall back to writing zeroes
+  // if the file system does not support it.
+  fallocate(fd, keep_size ? FALLOC_FL_KEEP_SIZE : 0, offset, size);
+#endif
+}
+
+static int RunBatch(const std::string &batch_file, int jobs,
+                    int argc, char *argv[]);
+static int RunSweep(const std::string &sweep, const std::string &directory,
+                    const char *extension, bool also_postscript,
+                    const ParameterRegistry &parameters,
+                    int jobs, int argc, char *argv[]);
+
+// Create a print as configured by the command line. Messages go to "log".
+// A "batch_job" is one line of a --batch file.
+static int CreatePrint(int argc, char *argv[], bool batch_job, FILE *log) {
+  ParameterRegistry parameters;   // All parameters below.
+  // Batch lines are reported briefly, not with all options each.
+  const auto usage = [&]() {
+    return batch_job ? 1 : parameters.Usage(argv[0]);
+  };
+
   ParamHeadline h1("Screw-data from template");
   StringParam fun_init    ("AABBBAABBBAABBB", "screw-template", 't', "Template string for screw.");
   FloatParam thread_depth (-1, "thread-depth", 'd',   "Depth of thread, initial-size/5 if negative");
   FloatParam twist        (0.0, "twist",        0,    "Twist ratio of angle per radius fraction (good -0.3..0.3)");
+  FloatParam template_tolerance(0.01, "template-tolerance", 0, "Maximum deviation in mm of the polygon from the template shape");
 
   ParamHeadline h2("Screw-data from polygon file");
-  StringParam polygon_file("", "polygon-file", 'D',  "File describing polygon. Files with x y pairs");
+  StringParam polygon_file("", "polygon-file", 'D',  "File describing polygon. Files with x y pairs, SVG path, or binary .polyb; '-' for stdin");
+  FloatParam curve_tolerance(0.01, "curve-tolerance", 0, "Maximum deviation in mm of the polygon from curves in SVG files");
 
   ParamHeadline h3("General Parameters");
   FloatParam total_height (-1,    "height", 'h', "Total height to be printed (must set)");
@@ -310,37 +608,104 @@ int main(int argc, char *argv[]) {
   FloatParam elephant_foot_multiplier (0.9,  "slender-elephant", 0, "Extrusion multiplier at first two layer heights to prevent elephant foot");
   FloatParam retract_amount (1.2, "retract", 0, "Millimeter of retract");
   FloatParam first_layer_feed_multiplier (0.7, "first-layer-speed", 0, "Feedrate multiplier for first layer");
+  BoolParam plan_feedrate(true, "plan-feedrate", 0, "Speed up layers that still take --layer-time with acceleration and corners");
   ParamHeadline h5("Printer Parameters");
   FloatParam nozzle_diameter(0.4, "nozzle-diameter", 0, "Diameter of extruder nozzle");
   FloatParam bed_temp(-1, "bed-temp", 0, "Bed temperature.");
   FloatParam temperature(190, "temperature", 0, "Extrusion temperature.");
   FloatParam temp_variation(0, "temperature-variation", 0, "Temperature variation around --temperature, e.g. to get dark lines in wood filament.");
   FloatParam filament_diameter(1.75, "filament-diameter", 0, "Diameter of filament");
+  FloatParam max_flow(0, "max-flow", 0, "Volumetric flow in mm³/s the hotend can melt. If > 0, extrusion is slowed down to stay within");
+  FloatParam max_segment_rate(0, "max-segment-rate", 0, "Segments per second the printer can process. If > 0, merge segments that are too short at the feed-rate");
+  FloatParam decimate_tolerance(0.02, "decimate-tolerance", 0, "Maximum deviation in mm when merging segments for --max-segment-rate");
+  FloatParam acceleration(1000, "acceleration", 0, "Acceleration of the printer in mm/s². For print time estimate");
+  FloatParam jerk(10, "jerk", 0, "Speed change in mm/s the printer does without acceleration at corners. For print time estimate");
+  FloatParam junction_deviation(0, "junction-deviation", 0, "If > 0, the printer limits corner speed with this junction deviation (mm) instead of --jerk");
+  IntParam planner_buffer(16, "planner-buffer", 0, "Number of moves the printer plans ahead");
   Vector2DParam machine_limit(Vector2D(150.0,150.0), "bed-size",    'L',  "x/y size limit of your printbed.");
   Vector2DParam head_offset(Vector2D(45.0,45.0),"head-offset", 'o', "dx/dy offset per print.");
   Vector2DParam edge_offset(Vector2D(5.0,5.0), "edge-offset",  0,  "Offset from the edge of the bed (bottom left origin).");
+  FloatParam gantry_height(0, "gantry-height", 0, "Clearance of the x-gantry above the nozzle. Screws not taller than that can be placed side by side");
 
   // Output options
   ParamHeadline h6("Output Options");
   BoolParam do_postscript(false, "postscript", 'P', "PostScript output instead of GCode output");
+  BoolParam binary_gcode(false, "binary-gcode", 0, "Compact binary GCode output instead of ASCII GCode");
   FloatParam postscript_thick_factor(1.0, "ps-thick-factor", 0, "Line thickness factor for shell size. Chooser smaller (e.g. 0.1) to better see overlaps");
   BoolParam matryoshka(false,    "nested",      0, "For PostScript: show nested (Matryoshka doll style)");
+  StringParam output_file("", "output", 0, "Output file. Default: stdout");
+  StringParam also_postscript("", "also-postscript", 0, "GCode output: also write a PostScript preview of the first layers to this file, replayed from the same toolpath");
+  IntParam jobs(1, "jobs", 'j', "Number of threads to create screws (or --batch lines) in parallel");
+  StringParam batch_file("", "batch", 0, "File with one set of options per line, each creating a print with its own --output");
+  StringParam sweep("", "sweep", 0, "Create prints for a grid of parameter values, e.g. pitch=20:40:10,layer-height=0.1:0.2:0.05");
+  StringParam sweep_dir("sweep", "sweep-dir", 0, "Directory for the --sweep prints and their index.tsv");
+  BoolParam multi_bed(false, "multi-bed", 0, "Print all screws, on as many beds as needed; one --output file per bed");
+  BoolParam print_layer_times(false, "layer-times", 0, "Print the estimated time of each layer");
+  BoolParam estimate(false, "estimate", 0, "Only estimate filament, time and placement on the bed; print as JSON to --output (or stdout) instead of creating the toolpath");
+  FloatParam arc_tolerance(0, "arc-tolerance", 0, "If > 0, GCode output: replace segments on a circular arc within this tolerance (mm) with G2/G3 arcs");
+  StringParam stats_file("", "stats", 0, "Write time spent in each phase and counts of what was done as JSON to this file");
+  BoolParam stats_hardware(false, "stats-hardware", 0, "With --stats: add CPU cycles, instructions and cache misses of each phase, if the kernel allows");
 
-  if (!SetParametersFromCommandline(argc, argv)) {
-    return ParameterUsage(argv[0]);
+  if (!parameters.SetFromCommandline(argc, argv)) {
+    return usage();
+  }
+
+  if (!batch_job && !batch_file.get().empty() && !sweep.get().empty()) {
+    fprintf(log, "Only one of --batch or --sweep\n");
+    return usage();
+  }
+  if (!batch_job && !batch_file.get().empty()) {
+    return RunBatch(batch_file, jobs, argc, argv);
+  }
+  if (!batch_job && !sweep.get().empty()) {
+    const char *extension = do_postscript ? "ps"
+      : (binary_gcode ? "bgcode" : "gcode");
+    return RunSweep(sweep, sweep_dir, extension,
+                    !also_postscript.get().empty(), parameters, jobs,
+                    argc, argv);
   }
 
   if (total_height < 0) {
-    fprintf(stderr, "\n--height needs to be set\n\n");
-    return ParameterUsage(argv[0]);
+    fprintf(log, "\n--height needs to be set\n\n");
+    return usage();
   }
 
   if (thread_depth < 0)
     thread_depth = initial_size / 5;
 
+  if (template_tolerance <= 0) {
+    fprintf(log, "--template-tolerance needs to be positive\n");
+    return usage();
+  }
+
+  if (curve_tolerance <= 0) {
+    fprintf(log, "--curve-tolerance needs to be positive\n");
+    return usage();
+  }
+
   if (matryoshka && !do_postscript) {
-    fprintf(stderr, "Matryoshka mode only valid with postscript\n");
-    return ParameterUsage(argv[0]);
+    fprintf(log, "Matryoshka mode only valid with postscript\n");
+    return usage();
+  }
+
+  if (estimate && do_postscript) {
+    fprintf(log, "--estimate is for GCode output\n");
+    return usage();
+  }
+
+  if (!also_postscript.get().empty() && (do_postscript || estimate)) {
+    fprintf(log, "--also-postscript is for GCode output\n");
+    return usage();
+  }
+
+  if (batch_job && output_file.get().empty()) {
+    fprintf(log, "Each --batch line needs its own --output file name\n");
+    return 1;
+  }
+
+  if (multi_bed && output_file.get().empty() && !estimate) {
+    fprintf(log, "--multi-bed needs an --output file name\n");
+    return usage();
   }
 
   // Calculated values from input parameters.
@@ -350,216 +715,715 @@ int main(int argc, char *argv[]) {
 
   matryoshka = matryoshka & do_postscript;   // Formulate it this way.
 
-  // Get polygon we'll be working on; either from rotational input or file.
-  Polygon input_polygon = (polygon_file.get().empty()
-                           ? RotationalPolygon(fun_init.get().c_str(),
-                                               initial_size,
-                                               thread_depth, twist)
-                           : ReadPolygon(polygon_file, initial_size));
+  // Only measured with --stats; the phases are free otherwise.
+  Stats stats_data(stats_hardware);
+  Stats *const stats = stats_file.get().empty() ? NULL : &stats_data;
+  // The offset cache is shared with other jobs of a batch; these count, too,
+  // while running in parallel.
+  const PolygonOffsetCacheStats offset_start = GetPolygonOffsetCacheStats();
 
-  // Add pump if needed.
-  if (pump > 0) {
-    input_polygon = RadialPumpPolygon(input_polygon, pump);
-  }
+  // The polygon only depends on these parameters, so prints in a batch or
+  // sweep that only differ in others share it.
+  char polygon_key[1024];
+  snprintf(polygon_key, sizeof(polygon_key),
+           "%s|%s|%.9g|%.9g|%.9g|%.9g|%.9g|%.9g|%.9g,%.9g|%d",
+           polygon_file.get().c_str(), fun_init.get().c_str(),
+           initial_size.get(), thread_depth.get(), twist.get(),
+           template_tolerance.get(), curve_tolerance.get(), pump.get(),
+           center_offset->x, center_offset->y, auto_center.get());
+  const Polygon base_polygon = CachedPolygon(polygon_key, [&]() {
+      ScopedPhase phase(stats, Stats::kPolygon);
+      // Get polygon we'll be working on; either from rotational input or file.
+      Polygon input_polygon = (polygon_file.get().empty()
+                               ? RotationalPolygon(fun_init.get().c_str(),
+                                                   initial_size,
+                                                   thread_depth, twist,
+                                                   template_tolerance)
+                               : ReadPolygon(polygon_file, initial_size,
+                                             curve_tolerance));
 
-  if (auto_center) {
-    center_offset = Centroid(input_polygon);
-    center_offset = Vector2D(0,0) - center_offset;
-  }
+      // Add pump if needed.
+      if (pump > 0) {
+        input_polygon = RadialPumpPolygon(input_polygon, pump);
+      }
 
-  // .. and offsetting
-  if (center_offset->x != 0 || center_offset->y != 0) {
-    input_polygon = OffsetCenter(input_polygon,
-                                 center_offset->x, center_offset->y);
-  }
+      if (auto_center) {
+        center_offset = Centroid(input_polygon);
+        center_offset = Vector2D(0,0) - center_offset;
+      }
 
-  const Polygon base_polygon = input_polygon;
+      // .. and offsetting
+      if (center_offset->x != 0 || center_offset->y != 0) {
+        input_polygon = OffsetCenter(input_polygon,
+                                     center_offset->x, center_offset->y);
+      }
+      return input_polygon;
+    });
   if (base_polygon.empty()) {
-    fprintf(stderr, "Polygon empty\n");
+    fprintf(log, "Polygon empty\n");
     return 1;
   }
   if (base_polygon.size() < 3) {
-    fprintf(stderr, "Polygon is a %sgon :) Need at least 3 vertices.\n",
+    fprintf(log, "Polygon is a %sgon :) Need at least 3 vertices.\n",
             base_polygon.size() == 1 ? "Mono" : "Duo");
     return 1;
   }
 
-  // Determine limits
+  // Polygons of all the screws we'd like to print. These are printed, so
+  // each is calculated from the base polygon for best accuracy.
+  std::vector<double> shell_offsets;
+  for (int i = 0; i < screw_count; ++i) {
+    const float offset = initial_shell + i * shell_increment;
+    shell_offsets.push_back(offset);
+  }
+  std::vector<Polygon> shells;
+  {
+    ScopedPhase phase(stats, Stats::kOffset);
+    shells = PolygonOffsetLadder(base_polygon, shell_offsets, false,
+                                 kOffsetRound, jobs);
+  }
+
+  // All screws we'd like to print.
+  std::vector<Screw> all_screws(screw_count);
+  for (int i = 0; i < screw_count; ++i) {
+    all_screws[i].index = i;
+    all_screws[i].offset = shell_offsets[i];
+    all_screws[i].polygon = shells[i];
+    all_screws[i].radius = shells[i].empty() ? 0 : GetRadius(shells[i]);
+  }
+
+  // Determine limits and which screws go on which bed where.
+  std::vector<Bed> beds;
   if (matryoshka) {
-    Polygon biggst_polygon
-      = PolygonOffset(base_polygon,
-                      initial_shell + (screw_count-1) * shell_increment);
+    ScopedPhase phase(stats, Stats::kLayout);
+    const Polygon biggst_polygon = shells.empty() ? Polygon() : shells.back();
     double max_radius = GetRadius(biggst_polygon) + brim;
     Vector2D poly_radius(max_radius + 5, max_radius + 5);
     machine_limit = poly_radius * 2;
     edge_offset = poly_radius;  // In matryoshka-case, edge_offset is center
+    beds.resize(1);
+    beds[0].screws = all_screws;
+    for (Screw &screw : beds[0].screws) {
+      screw.center = edge_offset;
+    }
   } else {
-    const Vector2D max_machine = machine_limit - edge_offset;
-    Vector2D pos = edge_offset;
-    float radius = GetRadius(PolygonOffset(base_polygon, initial_shell));
-    Vector2D screw_dimension(2 * (radius + brim), 2*(radius + brim));
+    ScopedPhase phase(stats, Stats::kLayout);
+    // Twisting screws cover the whole circle around their center.
+    const bool is_twisting = fabs(pitch) >= 0.1;
+    std::vector<int> printed;   // Shells that leave something to print.
+    std::vector<Box> footprint;
     for (int i = 0; i < screw_count; ++i) {
-      Vector2D new_pos = pos + screw_dimension;
-      if (new_pos.x > max_machine.x || new_pos.y > max_machine.y) {
-        fprintf(stderr, "With currently configured bedsize and printhead-offset, "
-                "only %d screws fit (radius is %.1fmm)\n"
-                "Configure your machine constraints with -L <x/y> -o < dx,dy> "
-                "(currently -L %.0f,%.0f -o %.0f,%.0f)\n", i, radius,
-                machine_limit->x, machine_limit->y,
-                head_offset->x, head_offset->y);
-        screw_count = i;
-        break;
+      if (shells[i].empty()) continue;
+      printed.push_back(i);
+      const Box outline = is_twisting
+        ? Box{ Vector2D(-1, -1) * all_screws[i].radius,
+               Vector2D(1, 1) * all_screws[i].radius }
+        : GetBoundingBox(shells[i]);
+      footprint.push_back({ outline.min - Vector2D(brim, brim),
+                            outline.max + Vector2D(brim, brim) });
+    }
+    BedConstraints constraints;
+    constraints.bed.min = edge_offset;
+    constraints.bed.max = machine_limit - edge_offset;
+    constraints.head_clearance = head_offset;
+    constraints.gantry_collides = (total_height > gantry_height);
+    // Fill one bed after another with the shells that are left.
+    int placed = 0;   // Shells in "printed" already placed on a bed.
+    int next_screw = 0;
+    do {
+      const std::vector<Box> remaining(footprint.begin() + placed,
+                                       footprint.end());
+      std::vector<Vector2D> centers;
+      const int fit = PlaceOnBed(remaining, constraints, &centers);
+      if (multi_bed && fit == 0 && !remaining.empty()) {
+        fprintf(log, "Screw for offset %.1f does not fit on the bed.\n",
+                all_screws[printed[placed]].offset);
+        return 1;
       }
-      pos = new_pos + head_offset;
-      screw_dimension = screw_dimension
-        + Vector2D(shell_increment, shell_increment) * 2;
+      placed += fit;
+      // All screws up to the next one that did not fit go on this bed,
+      // including the empty ones.
+      const int end_screw = (placed < (int)printed.size())
+        ? printed[placed] : screw_count;
+      Bed bed;
+      bed.screws.assign(all_screws.begin() + next_screw,
+                        all_screws.begin() + end_screw);
+      for (int i = 0; i < fit; ++i) {
+        bed.screws[printed[placed - fit + i] - next_screw].center = centers[i];
+      }
+      beds.push_back(bed);
+      next_screw = end_screw;
+    } while (multi_bed && next_screw < screw_count);
+    if (next_screw < screw_count) {
+      fprintf(log, "With currently configured bedsize and printhead-offset, "
+              "only %d screws fit\n"
+              "Configure your machine constraints with -L <x/y> -o < dx,dy> "
+              "--gantry-height <h> "
+              "(currently -L %.0f,%.0f -o %.0f,%.0f --gantry-height %.0f)\n"
+              "or use --multi-bed to print the remaining ones on more beds.\n",
+              next_screw, machine_limit->x, machine_limit->y,
+              head_offset->x, head_offset->y, gantry_height.get());
     }
-    pos = pos - head_offset;
-    // Now, pos is the largest corner. We can offset
-    // the edge_offset now to the difference to center things.
-    edge_offset = edge_offset + (max_machine - pos - edge_offset) / 2;
   }
 
   const double filament_extrusion_factor = shell_thickness_factor *
     (nozzle_radius * (layer_height/2)) / (filament_radius*filament_radius);
 
-  Printer *printer = NULL;
   if (do_postscript) {
     total_height = std::min(total_height.get(),
                             3 * layer_height); // not needed more.
-    // no move lines w/ Matryoshka
-    printer = CreatePostscriptPrinter(!matryoshka,
-                                      postscript_thick_factor * shell_thickness);
-  } else {
-    printer = CreateGCodePrinter(filament_extrusion_factor, retract_amount,
-                                 temperature, bed_temp);
   }
-  printer->Preamble(machine_limit, feed_mm_per_sec);
 
-  printer->Comment("https://github.com/hzeller/gcode-multi-shell-extrude\n");
-  printer->Comment("\n");
-  printer->Comment(" ");
-  for (int i = 0; i < argc; ++i)
-    printf("%s ", argv[i]);
-  printf("\n");
-  printer->Comment("\n");
-  if (!polygon_file.get().empty()) {
-    printer->Comment("Polygon from polygon-file '%s'\n",
-                     polygon_file.get().c_str());
-    printer->Comment("size-factor=%.1f\n", initial_size.get());
-  } else {
-    printer->Comment("Polygon from screw template '%s'\n",
-                     fun_init.get().c_str());
-    printer->Comment("thread-depth=%.1fmm size=%.1fmm (radius)\n",
-                     thread_depth.get(), initial_size.get());
-  }
-  printer->Comment("h=%.1fmm n=%d (shell-increment=%.1fmm)\n",
-                   total_height.get(), screw_count.get(), shell_increment.get());
-  printer->Comment("feed=%.1fmm/s (maximum; layer time at least %.1f s)\n",
-                   feed_mm_per_sec.get(), min_layer_time.get());
-  printer->Comment("pitch=%.1fmm/turn layer-height=%.3f\n",
-                   pitch.get(), layer_height.get());
-  printer->Comment("machine limits: bed: (%.0f/%.0f):  "
-                  "head-offset: (%.0f,%.0f)\n",
-                   machine_limit->x, machine_limit->y,
-                   head_offset->x, head_offset->y);
-  printer->Comment("----\n");
-
-  printer->Init(machine_limit, feed_mm_per_sec);
+  // Volumetric flow translated to E-axis speed.
+  const double max_e_feedrate
+    = max_flow / (M_PI * filament_radius * filament_radius);
+  MotionLimits motion_limits;
+  motion_limits.acceleration = acceleration;
+  motion_limits.jerk = jerk;
+  motion_limits.junction_deviation = junction_deviation;
+  motion_limits.buffer_size = planner_buffer;
 
   // How much the whole system should rotate per mm height.
   const double rotation_per_mm = (fabs(pitch) < 0.1) ? 0 : 1.0 / pitch;
 
-  double total_time = 0;
+  // Planning faster than the flow limit allows doesn't help.
+  double max_shell_feedrate = feed_mm_per_sec;
+  if (max_e_feedrate > 0) {
+    max_shell_feedrate = std::min(max_shell_feedrate,
+                                  max_e_feedrate / filament_extrusion_factor);
+  }
+
+  ScrewParams screw_params;
+  screw_params.extrusion.feedrate = feed_mm_per_sec;
+  screw_params.extrusion.layer_height = layer_height;
+  screw_params.extrusion.total_height = total_height;
+  screw_params.extrusion.rotation_per_mm = rotation_per_mm;
+  screw_params.extrusion.lock_offset = lock_offset;
+  screw_params.extrusion.fan_on_height = fan_on;
+  screw_params.extrusion.elephant_foot_multiplier = elephant_foot_multiplier;
+  screw_params.extrusion.first_layer_feedrate_multiplier
+    = first_layer_feed_multiplier;
+  screw_params.extrusion.arc_tolerance = arc_tolerance;
+  screw_params.extrusion.max_segment_rate = max_segment_rate;
+  screw_params.extrusion.decimate_tolerance = decimate_tolerance;
+  screw_params.extrusion.plan_feedrate = plan_feedrate;
+  screw_params.extrusion.max_feedrate = max_shell_feedrate;
+  screw_params.extrusion.min_layer_time = min_layer_time;
+  screw_params.extrusion.motion_limits = motion_limits;
+  screw_params.extrusion.base_temp = temperature;
+  screw_params.extrusion.temp_variation = temp_variation;
+  screw_params.feed_mm_per_sec = feed_mm_per_sec;
+  screw_params.min_layer_time = min_layer_time;
+  screw_params.total_height = total_height;
+  screw_params.hover_pos = 10.0;
+  screw_params.vessel = vessel;
+  screw_params.vessel_hole = vessel_hole;
+  screw_params.brim = brim;
+  screw_params.brim_spiral_distance = shell_thickness * brim_spiral_factor;
+  screw_params.brim_smooth_radius = brim_smooth_radius;
+  screw_params.stats = stats;
+
+  std::string cmdline;
+  for (int i = 0; i < argc; ++i)
+    cmdline.append(argv[i]).append(" ");
+
+  // Beds are created in parallel, the remaining threads are used for
+  // the screws within each bed.
+  const int bed_jobs = std::max(1, std::min<int>(jobs, beds.size()));
+  const int screw_jobs = std::max(1, jobs / bed_jobs);
+  if (multi_bed && !output_file.get().empty()) {
+    for (size_t b = 0; b < beds.size(); ++b) {
+      beds[b].filename = BedFilename(output_file, b + 1);
+    }
+  } else {
+    beds[0].filename = output_file;
+  }
+  if (multi_bed && !also_postscript.get().empty()) {
+    for (size_t b = 0; b < beds.size(); ++b) {
+      beds[b].preview_filename = BedFilename(also_postscript, b + 1);
+    }
+  } else {
+    beds[0].preview_filename = also_postscript;
+  }
+
+  std::atomic<bool> output_ok(true);
+  ParallelFor(beds.size(), bed_jobs, [&](int b) {
+    Bed &bed = beds[b];
+    const std::vector<Screw> &screws = bed.screws;
+    if (estimate) {
+      ScrewParams params = screw_params;
+      params.offset_jobs = screw_jobs;
+      EstimateBed(params, &bed);
+      return;
+    }
+    int out_fd = STDOUT_FILENO;
+    const bool own_file = !bed.filename.empty();
+    bool preallocated = false;
+    off_t start_offset = 0;   // Where our output starts in the file.
+    {
+      ScopedPhase phase(stats, Stats::kOutput);
+      if (!bed.filename.empty()) {
+        out_fd = open(bed.filename.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if (out_fd < 0) {
+          fprintf(log, "%s: %s\n", bed.filename.c_str(), strerror(errno));
+          output_ok = false;
+          return;
+        }
+      }
+      // Allocating the file in one go is cheaper than growing it, in
+      // particular on network file systems. Stdout might be a file that is
+      // appended to, or already has content from others before ours.
+      struct stat out_stat;
+      if (!own_file) start_offset = lseek(out_fd, 0, SEEK_CUR);
+      preallocated = (fstat(out_fd, &out_stat) == 0
+                      && S_ISREG(out_stat.st_mode)
+                      && start_offset >= 0
+                      && (fcntl(out_fd, F_GETFL) & O_APPEND) == 0);
+      if (preallocated) {
+        const int bytes_per_vertex
+          = do_postscript ? 28 : (binary_gcode ? 3 : 38);
+        PreallocateFile(out_fd, start_offset,
+                        EstimateOutputSize(screws, total_height,
+                                           layer_height, bytes_per_vertex),
+                        !own_file);
+      }
+    }
+    BackgroundWriter writer(out_fd);
+    OutputBuffer *const out = new OutputBuffer(&writer);
+
+    Printer *printer = NULL;
+    if (do_postscript) {
+      // no move lines w/ Matryoshka
+      printer = CreatePostscriptPrinter(out, !matryoshka,
+                                        postscript_thick_factor * shell_thickness);
+    } else if (binary_gcode) {
+      printer = CreateBinaryGCodePrinter(out, filament_extrusion_factor,
+                                         retract_amount, temperature, bed_temp,
+                                         max_e_feedrate, motion_limits);
+    } else {
+      printer = CreateGCodePrinter(out, filament_extrusion_factor,
+                                   retract_amount, temperature, bed_temp,
+                                   max_e_feedrate, motion_limits);
+    }
+    if (stats) {
+      printer = CreateCountingPrinter(printer, stats);
+    }
+    // The preview, like PostScript output, only needs the first layers.
+    Toolpath preview(3 * layer_height);
+    if (!bed.preview_filename.empty()) {
+      printer = CreateToolpathRecorder(printer, &preview);
+    }
+    printer->Preamble(machine_limit, feed_mm_per_sec);
+
+    printer->Comment("https://github.com/hzeller/gcode-multi-shell-extrude\n");
+    printer->Comment("\n");
+    printer->Comment(" %s\n", cmdline.c_str());
+    printer->Comment("\n");
+    if (!polygon_file.get().empty()) {
+      printer->Comment("Polygon from polygon-file '%s'\n",
+                       polygon_file.get().c_str());
+      printer->Comment("size-factor=%.1f\n", initial_size.get());
+    } else {
+      printer->Comment("Polygon from screw template '%s'\n",
+                       fun_init.get().c_str());
+      printer->Comment("thread-depth=%.1fmm size=%.1fmm (radius)\n",
+                       thread_depth.get(), initial_size.get());
+    }
+    if (multi_bed && !screws.empty()) {
+      printer->Comment("bed %d of %d: start-offset=%.1fmm\n",
+                       b + 1, (int)beds.size(), screws[0].offset);
+    }
+    printer->Comment("h=%.1fmm n=%d (shell-increment=%.1fmm)\n",
+                     total_height.get(), (int)screws.size(),
+                     shell_increment.get());
+    printer->Comment("feed=%.1fmm/s (maximum; layer time at least %.1f s)\n",
+                     feed_mm_per_sec.get(), min_layer_time.get());
+    printer->Comment("pitch=%.1fmm/turn layer-height=%.3f\n",
+                     pitch.get(), layer_height.get());
+    printer->Comment("machine limits: bed: (%.0f/%.0f):  "
+                     "head-offset: (%.0f,%.0f)\n",
+                     machine_limit->x, machine_limit->y,
+                     head_offset->x, head_offset->y);
+    printer->Comment("----\n");
+
+    printer->Init(machine_limit, feed_mm_per_sec);
+
+    ScrewParams params = screw_params;
+    params.offset_jobs = screw_jobs;
+    printer->SetSpeed(feed_mm_per_sec);  // initial speed.
+    bed.results.resize(screws.size());
+    Printer *const detached = (screw_jobs > 1)
+      ? printer->CreateDetached() : NULL;
+    if (detached) {
+      delete detached;   // Just checking that the printer supports it.
+      params.offset_jobs = 1;   // Already parallel per screw.
+      CreateScrewsParallel(screws, params, screw_jobs, printer, &bed.results);
+    } else {
+      for (size_t i = 0; i < screws.size(); ++i) {
+        if (screws[i].polygon.empty()) continue;
+        bed.results[i] = CreateScrew(screws[i], params, printer);
+      }
+    }
+
+    // All moves are done, so this includes travel between screws.
+    bed.time = printer->GetPrintTime();
+    ScopedPhase phase(stats, Stats::kOutput);
+    printer->Postamble();
+    delete printer;
+    writer.Finish();
+    const char *const out_name
+      = own_file ? bed.filename.c_str() : "stdout";
+    if (writer.error() != 0) {
+      // A partial file must not look like a finished print.
+      fprintf(log, "%s: %s\n", out_name, strerror(writer.error()));
+      output_ok = false;
+    } else if (preallocated) {
+      // Cut off what we might have preallocated too much. Content others
+      // wrote after ours to a file we did not open is kept.
+      const off_t end = start_offset + writer.bytes_written();
+      struct stat out_stat;
+      if ((own_file || (fstat(out_fd, &out_stat) == 0
+                        && out_stat.st_size <= end))
+          && ftruncate(out_fd, end) != 0) {
+        fprintf(log, "%s: truncating: %s\n", out_name, strerror(errno));
+        output_ok = false;
+      }
+    }
+    if (out_fd != STDOUT_FILENO) {
+      close(out_fd);
+    }
+    if (stats) {
+      stats->Add("counts", "bytes_written", writer.bytes_written());
+    }
+    if (!bed.preview_filename.empty()) {
+      if (!WritePreview(preview, bed.preview_filename,
+                        postscript_thick_factor * shell_thickness, log)) {
+        output_ok = false;
+      }
+      if (stats) {
+        stats->Add("counts", "toolpath_records", preview.records());
+        stats->Add("counts", "toolpath_bytes", preview.bytes());
+      }
+    }
+  });
+  if (!output_ok)
+    return 1;
+
   double total_travel = 0;
+  double total_time = 0;
+  for (const Bed &bed : beds) {
+    for (size_t i = 0; i < bed.screws.size(); ++i) {
+      const Screw &screw = bed.screws[i];
+      if (screw.polygon.empty()) {
+        fprintf(log, "Polygon offset %.1f results in empty polygon\n",
+                screw.offset);
+        continue;
+      }
+      const ScrewResult &result = bed.results[i];
+      total_travel += result.travel;
+      if (stats) {
+        stats->Add("counts", "screws", 1);
+        stats->Add("counts", "vertices", screw.polygon.size());
+        stats->Add("counts", "layers", result.layer_time.size());
+      }
+      if (!do_postscript) {
+        fprintf(log, "Screw-surface (out+in) for offset %.1f: ~%.1f cm²\n",
+                screw.offset, result.area / 100);
+        const std::vector<float> &layer_time = result.layer_time;
+        fprintf(log, "Estimated time for offset %.1f: %s", screw.offset,
+                FormatTime(result.time).c_str());
+        if (!layer_time.empty()) {
+          fprintf(log, " (layers %.1fs .. %.1fs)",
+                  *std::min_element(layer_time.begin(), layer_time.end()),
+                  *std::max_element(layer_time.begin(), layer_time.end()));
+        }
+        fprintf(log, "\n");
+        if (print_layer_times) {
+          for (size_t i = 0; i < layer_time.size(); ++i) {
+            fprintf(log, "  layer %zu: %.2fs\n", i + 1, layer_time[i]);
+          }
+        }
+      }
+      if (result.flow_limited_moves > 0) {
+        fprintf(log, "Flow limit for offset %.1f: slowed down %d "
+                "extrusion moves\n", screw.offset, result.flow_limited_moves);
+      }
+      if (max_segment_rate > 0) {
+        fprintf(log, "Decimation for offset %.1f removed %d segments\n",
+                screw.offset, result.segments_removed);
+      }
+    }
+    total_time += bed.time;
+  }
 
-  constexpr float kHoverPos = 10.0;  // Hovering over screws while moving
-  Vector2D center = edge_offset;
-  printer->SetSpeed(feed_mm_per_sec);  // initial speed.
-  for (int i = 0; i < screw_count; ++i) {
-    const float current_offset = initial_shell + i * shell_increment;
-    Polygon polygon = PolygonOffset(base_polygon, current_offset);
-    if (polygon.size() == 0) {
-      fprintf(stderr, "Polygon offset %.1f results in empty polygon\n",
-              initial_shell + i * shell_increment);
-      continue;
+  if (multi_bed) {
+    for (size_t b = 0; b < beds.size(); ++b) {
+      const Bed &bed = beds[b];
+      fprintf(log, "Bed %zu: %s%s%d screws, start-offset=%.1f",
+              b + 1, bed.filename.c_str(), bed.filename.empty() ? "" : ": ",
+              (int)bed.screws.size(),
+              bed.screws.empty() ? initial_shell.get() : bed.screws[0].offset);
+      if (!do_postscript) {
+        fprintf(log, "; estimated time %s",
+                FormatTime(bed.time).c_str());
+      }
+      fprintf(log, "\n");
     }
-    const double radius = GetRadius(polygon);
-    Vector2D screw_radius(radius + brim, radius + brim);
-    if (!matryoshka) {
-      // We start here.
-      center = center + screw_radius;
-    }
-    printer->MoveTo(center, i > 0 ? total_height + kHoverPos : kHoverPos);
-    const float polygon_len = CalcPolygonLen(polygon);
-    const float area = polygon_len * total_height * 2;  // inside and out.
-    float layer_feedrate =  polygon_len / min_layer_time;
-    layer_feedrate = std::min(layer_feedrate, feed_mm_per_sec.get());
-    printer->ResetExtrude();
-    printer->SetSpeed(layer_feedrate);
-    printer->Comment("Screw #%d, polygon-offset=%.1f\n",
-                     i+1, initial_shell + i * shell_increment);
-    if (vessel) {
-      const float spiral_layer_distance = shell_thickness * brim_spiral_factor;
-      printer->Comment("Create vessel-bottom\n");
-      printer->SetColor(0.5, 0, 0.5);
-      printer->SetSpeed(feed_mm_per_sec / 2);
-      CreateBottomPlate(polygon, printer, center,
-                        0, -radius+vessel_hole, spiral_layer_distance);
-      // TODO: make this multi-layer.
-      printer->GoZPos(2);
-    }
-
-    if (brim > 0) {
-      const float spiral_layer_distance = shell_thickness * brim_spiral_factor;
-      int layers = (int) ceil(brim / spiral_layer_distance);
-      Polygon brim_polygon = polygon;
-      if (brim_smooth_radius > 0)
-        brim_polygon = PolygonOffset(PolygonOffset(polygon, brim_smooth_radius), -brim_smooth_radius);
-      printer->Comment("Create brim\n");
-      printer->SetColor(0, 0.5, 0);
-      printer->SetSpeed(feed_mm_per_sec / 2);
-      CreateBottomPlate(brim_polygon, printer, center,
-                        layers * spiral_layer_distance, spiral_layer_distance/2,
-                        spiral_layer_distance);
-    }
-    ExtrusionParams params = {
-      .feedrate = layer_feedrate,
-      .layer_height = layer_height,
-      .total_height = total_height,
-      .rotation_per_mm = rotation_per_mm,
-      .lock_offset = lock_offset,
-      .fan_on_height = fan_on,
-      .elephant_foot_multiplier = elephant_foot_multiplier,
-      .first_layer_feedrate_multiplier = first_layer_feed_multiplier,
-      .base_temp = temperature,
-      .temp_variation = temp_variation
-    };
-
-    CreateExtrusion(polygon, printer, center, params);
-    const double travel = printer->GetExtrusionDistance();  // since last reset.
-    total_travel += travel;
-    total_time += travel / layer_feedrate;  // roughly (without acceleration)
-    printer->SetSpeed(feed_mm_per_sec);
-    printer->Retract();
-    printer->GoZPos(total_height + kHoverPos);
-    if (!matryoshka) {
-      center = center + screw_radius + head_offset;
-    }
-    if (!do_postscript) {
-      fprintf(stderr, "Screw-surface (out+in) for offset %.1f: ~%.1f cm²\n",
-              current_offset, area / 100);
-    }
-  }
-
-  printer->Postamble();
+  }
   if (!do_postscript) {  // doesn't make sense to print for PostScript
-    int t = (int)total_time;
-    const int hours = t / 3600;
-    t %= 3600;
-    const int minutes = t / 60;
-    const int seconds = t % 60;
-    fprintf(stderr, "Total time >= %02d:%02d:%02d; %.2fm filament\n", hours,
-            minutes, seconds, total_travel * filament_extrusion_factor / 1000);
+    fprintf(log, "Estimated total time %s; %.2fm filament\n",
+            FormatTime(total_time).c_str(),
+            total_travel * filament_extrusion_factor / 1000);
+  }
+  if (estimate) {
+    // Batch jobs always have their own --output, so only a single job
+    // writes to stdout.
+    const bool to_stdout = output_file.get().empty();
+    FILE *out = to_stdout ? stdout : fopen(output_file.get().c_str(), "w");
+    bool json_ok = (out != NULL);
+    if (out != NULL) {
+      PrintEstimate(beds, screw_count, filament_extrusion_factor, out);
+      json_ok = (fflush(out) == 0 && !ferror(out));
+      if (!to_stdout && fclose(out) != 0) json_ok = false;
+    }
+    if (!json_ok) {
+      fprintf(log, "%s: %s\n", to_stdout
+              ? "stdout" : output_file.get().c_str(), strerror(errno));
+      return 1;
+    }
+  }
+  if (stats) {
+    const PolygonOffsetCacheStats offset_end = GetPolygonOffsetCacheStats();
+    stats->Add("polygon_offsets", "computed",
+               offset_end.misses - offset_start.misses);
+    stats->Add("polygon_offsets", "from_cache",
+               offset_end.hits - offset_start.hits);
+  }
+  if (stats && !stats->WriteJson(stats_file)) {
+    fprintf(log, "%s: %s\n", stats_file.get().c_str(), strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+// Split a line of a batch file into arguments, separated by whitespace.
+// Quotes group arguments with whitespace.
+static std::vector<std::string> SplitArguments(const std::string &line) {
+  std::vector<std::string> result;
+  std::string arg;
+  bool in_arg = false;
+  char quote = 0;
+  for (const char c : line) {
+    if (quote) {
+      if (c == quote) quote = 0; else arg.append(1, c);
+    } else if (c == '"' || c == '\'') {
+      quote = c;
+      in_arg = true;
+    } else if (isspace(c)) {
+      if (in_arg) result.push_back(arg);
+      arg.clear();
+      in_arg = false;
+    } else {
+      arg.append(1, c);
+      in_arg = true;
+    }
+  }
+  if (in_arg) result.push_back(arg);
+  return result;
+}
+
+// A print of a batch or sweep: its command line, and a name for messages.
+struct Job {
+  std::string name;
+  std::vector<std::string> args;
+};
+
+// Create the prints of all "batch" jobs, with "jobs" in parallel. The
+// messages of each job are printed once it is done. Each job's return
+// value is stored in "results".
+static void RunJobs(std::vector<Job> *batch, int jobs,
+                    std::vector<int> *results) {
+  results->resize(batch->size());
+  std::mutex log_mutex;
+  ParallelFor(batch->size(), jobs, [&](int i) {
+      std::vector<std::string> &args = (*batch)[i].args;
+      std::vector<char*> job_argv;
+      for (std::string &arg : args) {
+        job_argv.push_back(&arg[0]);
+      }
+      job_argv.push_back(NULL);
+      char *log_buffer = NULL;
+      size_t log_size = 0;
+      FILE *log = open_memstream(&log_buffer, &log_size);
+      const int result = CreatePrint(job_argv.size() - 1, job_argv.data(),
+                                     true, log);
+      fclose(log);
+      (*results)[i] = result;
+      std::lock_guard<std::mutex> l(log_mutex);
+      fprintf(stderr, "--- %s%s\n%s", (*batch)[i].name.c_str(),
+              result == 0 ? "" : " FAILED", log_buffer);
+      free(log_buffer);
+    });
+  const int failed = batch->size()
+    - std::count(results->begin(), results->end(), 0);
+  fprintf(stderr, "Batch done: %d of %d failed.\n",
+          failed, (int)batch->size());
+}
+
+// Create a print for each line of the "batch_file", with "jobs" in
+// parallel. The options of each line are added to the ones given on the
+// command line.
+static int RunBatch(const std::string &batch_file, int jobs,
+                    int argc, char *argv[]) {
+  std::ifstream in(batch_file);
+  if (!in) {
+    fprintf(stderr, "Can't open %s\n", batch_file.c_str());
+    return 1;
   }
+  std::vector<Job> batch;
+  std::string line;
+  for (int line_no = 1; std::getline(in, line); ++line_no) {
+    const size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string::npos || line[start] == '#')
+      continue;
+    Job job;
+    job.name = batch_file + ":" + std::to_string(line_no);
+    job.args.assign(argv, argv + argc);
+    job.args.push_back("--jobs=1");   // Already parallel per line.
+    for (const std::string &arg : SplitArguments(line)) {
+      job.args.push_back(arg);
+    }
+    batch.push_back(job);
+  }
+  std::vector<int> results;
+  RunJobs(&batch, jobs, &results);
+  return std::count(results.begin(), results.end(), 0) == (int)batch.size()
+    ? 0 : 1;
+}
+
+// Values of a swept parameter.
+struct SweepRange {
+  std::string name;
+  std::vector<double> values;
+};
+
+// Parse a sweep such as "pitch=20:40:10,layer-height=0.1:0.2:0.05", a
+// comma separated list of parameter=from:to:step. Returns false and prints
+// a message if that is not possible.
+static bool ParseSweep(const std::string &sweep,
+                       const ParameterRegistry &parameters,
+                       std::vector<SweepRange> *ranges) {
+  std::istringstream in(sweep);
+  std::string spec;
+  while (std::getline(in, spec, ',')) {
+    const size_t equals = spec.find('=');
+    double from, to, step;
+    if (equals == std::string::npos
+        || sscanf(spec.c_str() + equals + 1, "%lf:%lf:%lf",
+                  &from, &to, &step) != 3
+        || step <= 0 || to < from) {
+      fprintf(stderr, "--sweep: expected parameter=from:to:step with "
+              "from <= to and step > 0, got '%s'\n", spec.c_str());
+      return false;
+    }
+    SweepRange range;
+    range.name = spec.substr(0, equals);
+    const Parameter *param = parameters.Find(range.name.c_str());
+    if (param == NULL || !param->RequiresValue()) {
+      fprintf(stderr, "--sweep: '%s' is not a parameter with a value\n",
+              range.name.c_str());
+      return false;
+    }
+    const int count = (int) floor((to - from) / step + 1e-6) + 1;
+    for (int i = 0; i < count; ++i) {
+      range.values.push_back(from + i * step);
+    }
+    ranges->push_back(range);
+  }
+  return !ranges->empty();
+}
+
+// Create a print for each point of the grid of parameter values given
+// in "sweep", with "jobs" in parallel. Outputs are written to "directory",
+// together with an index.tsv listing the parameters of each output file.
+static int RunSweep(const std::string &sweep, const std::string &directory,
+                    const char *extension, bool also_postscript,
+                    const ParameterRegistry &parameters,
+                    int jobs, int argc, char *argv[]) {
+  std::vector<SweepRange> ranges;
+  if (!ParseSweep(sweep, parameters, &ranges))
+    return 1;
+  if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "%s: %s\n", directory.c_str(), strerror(errno));
+    return 1;
+  }
+
+  // Go through the grid like an odometer; the last parameter changes first.
+  std::vector<Job> batch;
+  std::vector<std::string> files;
+  std::vector<std::vector<std::string> > grid_values;
+  std::vector<size_t> index(ranges.size(), 0);
+  for (;;) {
+    Job job;
+    job.args.assign(argv, argv + argc);
+    job.args.push_back("--jobs=1");   // Already parallel per grid point.
+    std::vector<std::string> values;
+    for (size_t r = 0; r < ranges.size(); ++r) {
+      char value[32];
+      snprintf(value, sizeof(value), "%g", ranges[r].values[index[r]]);
+      values.push_back(value);
+      job.args.push_back("--" + ranges[r].name + "=" + value);
+      job.name.append(job.name.empty() ? "" : " ")
+        .append(ranges[r].name).append("=").append(value);
+    }
+    char file[32];
+    snprintf(file, sizeof(file), "sweep-%04d.%s", (int)batch.size() + 1,
+             extension);
+    job.args.push_back("--output=" + directory + "/" + file);
+    files.push_back(file);
+    if (also_postscript) {
+      snprintf(file, sizeof(file), "sweep-%04d.ps", (int)batch.size() + 1);
+      job.args.push_back("--also-postscript=" + directory + "/" + file);
+    }
+    batch.push_back(job);
+    grid_values.push_back(values);
+
+    int r = ranges.size() - 1;
+    while (r >= 0 && ++index[r] == ranges[r].values.size()) {
+      index[r--] = 0;
+    }
+    if (r < 0)
+      break;
+  }
+
+  std::vector<int> results;
+  RunJobs(&batch, jobs, &results);
+
+  const std::string index_file = directory + "/index.tsv";
+  FILE *out = fopen(index_file.c_str(), "w");
+  if (!out) {
+    fprintf(stderr, "%s: %s\n", index_file.c_str(), strerror(errno));
+    return 1;
+  }
+  fprintf(out, "file");
+  for (const SweepRange &range : ranges) {
+    fprintf(out, "\t%s", range.name.c_str());
+  }
+  fprintf(out, "\tstatus\n");
+  for (size_t i = 0; i < batch.size(); ++i) {
+    fprintf(out, "%s", files[i].c_str());
+    for (const std::string &value : grid_values[i]) {
+      fprintf(out, "\t%s", value.c_str());
+    }
+    fprintf(out, "\t%s\n", results[i] == 0 ? "ok" : "failed");
+  }
+  fclose(out);
+  fprintf(stderr, "Sweep of %d prints in %s\n", (int)batch.size(),
+          index_file.c_str());
+  return std::count(results.begin(), results.end(), 0) == (int)batch.size()
+    ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+  return CreatePrint(argc, argv, false, stderr);
 }
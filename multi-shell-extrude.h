@@ -5,8 +5,10 @@
 #ifndef MULTI_SHELL_EXTRUDE_H_
 #define MULTI_SHELL_EXTRUDE_H_
 
+#include <string>
 #include <vector>
 #include <math.h>
+#include <stdint.h>
 
 struct Vector2D {
   Vector2D() : x(0), y(0) {}
@@ -15,8 +17,6 @@ struct Vector2D {
 
   double x, y;
 };
-typedef std::vector<Vector2D> Polygon;
-
 inline Vector2D operator+(const Vector2D &a, const Vector2D &b) {
   return Vector2D(a.x + b.x, a.y + b.y);
 }
@@ -34,24 +34,86 @@ inline Vector2D rotate(const Vector2D &v, float angle) {
                   v.y * cos(angle) + v.x * sin(angle));
 }
 
+// Polygons are kept in fixed point: coordinates are integers in units of
+// 1/kFixedPointScale mm. That is what the polygon offset (clipper) works
+// with, so there is no conversion between geometry operations; only the
+// final layer output is converted to floating point with FromFixed().
+const double kFixedPointScale = 1e4;
+struct FixedPoint {
+  FixedPoint() : x(0), y(0) {}
+  FixedPoint(int64_t xx, int64_t yy) : x(xx), y(yy) {}
+
+  int64_t x, y;
+};
+typedef std::vector<FixedPoint> Polygon;
+
+inline int64_t ToFixed(double mm) { return llround(mm * kFixedPointScale); }
+inline FixedPoint ToFixed(const Vector2D &v) {
+  return FixedPoint(ToFixed(v.x), ToFixed(v.y));
+}
+inline double FromFixed(int64_t value) { return value / kFixedPointScale; }
+inline Vector2D FromFixed(const FixedPoint &p) {
+  return Vector2D(FromFixed(p.x), FromFixed(p.y));
+}
+
 // Calculate euclidian distance.
 inline double distance(double dx, double dy, double dz) {
   return sqrt(dx*dx + dy*dy + dz*dz);
 }
 
-// Determine the centroid for polygon.
+// Determine the centroid for polygon; in mm.
 Vector2D Centroid(const Polygon &polygon);
 
+// The total length of distance going through a polygon; in mm.
+// In vector2d.cc
+double CalcPolygonLen(const Polygon &polygon);
+
+// Read polygon from a file of x y coordinates per line or an SVG path, scaled
+// by "factor". SVG curves are flattened to within "curve_tolerance" mm after
+// scaling. Files are only read once per process. In polygon-file.cc
+Polygon ReadPolygon(const std::string &filename, double factor,
+                    double curve_tolerance);
+
 // Create a polygon from a string "fun_init", describing "thread_depth"
-// offsets from an "inner_radius". In rotational-polygon.cc
+// offsets from an "inner_radius". The polygon does not deviate more than
+// "max_error" from the described shape. In rotational-polygon.cc
 Polygon RotationalPolygon(const char *fun_init, double inner_radius,
-			  double thread_depth, double twist);
+			  double thread_depth, double twist, double max_error);
 
 // Offset an polygon. Minkowski with disk of radius "offset".
 // The actual Minkowski sum would have arc segments, that is flattened as
-// line segments. In polygon-offset.cc
+// line segments. Results are cached, so asking for the same offset again is
+// cheap. In polygon-offset.cc
 enum OffsetType { kOffsetRound, kOffsetSquare, kOffsetMiter };
 Polygon PolygonOffset(const Polygon &in, double offset,
                       OffsetType type = kOffsetRound);
 
+// Offset polygon by each of the "offsets", e.g. for the rings of a brim.
+// Faster than separate calls to PolygonOffset(): the polygon is converted
+// only once and rings are computed using up to "jobs" threads.
+// If "derive" is true, rings are derived from neighboring rings where
+// possible, which is faster for large polygons, but each step adds up to
+// another 0.01mm corner approximation error. Otherwise, rings are the same
+// as from PolygonOffset() and shared with its cache.
+// Polygons with nothing left after offset are empty. In polygon-offset.cc
+std::vector<Polygon> PolygonOffsetLadder(const Polygon &in,
+                                         const std::vector<double> &offsets,
+                                         bool derive,
+                                         OffsetType type = kOffsetRound,
+                                         int jobs = 1);
+
+// Number of PolygonOffset() calls answered from the cache or computed.
+struct PolygonOffsetCacheStats {
+  int hits;
+  int misses;
+};
+PolygonOffsetCacheStats GetPolygonOffsetCacheStats();
+
+// Remove vertices in runs of segments shorter than "min_segment_len" (as
+// they'd exceed the segments per second a printer can handle) with
+// Douglas-Peucker, so that the path stays within "tolerance" of the
+// original. In polygon-decimate.cc
+Polygon DecimatePolygon(const Polygon &in, double tolerance,
+                        double min_segment_len);
+
 #endif  // MULTI_SHELL_EXTRUDE_H_
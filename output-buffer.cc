@@ -0,0 +1,189 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "output-buffer.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "background-writer.h"
+
+OutputBuffer::OutputBuffer(int fd, size_t buffer_size)
+  : fd_(fd), writer_(NULL), buffer_(new char[buffer_size]),
+    end_(buffer_ + buffer_size), pos_(buffer_) {
+}
+
+OutputBuffer::OutputBuffer() : OutputBuffer(-1, 4096) {}
+
+OutputBuffer::OutputBuffer(BackgroundWriter *writer)
+  : fd_(-1), writer_(writer), buffer_(writer->GetBuffer()),
+    end_(buffer_ + writer->buffer_size()), pos_(buffer_) {
+}
+
+OutputBuffer::~OutputBuffer() {
+  Flush();
+  if (!writer_) delete [] buffer_;
+}
+
+static void WriteFully(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    const ssize_t w = write(fd, data, len);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      perror("Writing output");
+      return;
+    }
+    data += w;
+    len -= w;
+  }
+}
+
+void OutputBuffer::Flush() {
+  if (writer_) {
+    if (pos_ == buffer_) return;
+    writer_->Submit(pos_ - buffer_);
+    buffer_ = writer_->GetBuffer();
+    end_ = buffer_ + writer_->buffer_size();
+    pos_ = buffer_;
+    return;
+  }
+  if (fd_ < 0)
+    return;
+  WriteFully(fd_, buffer_, pos_ - buffer_);
+  pos_ = buffer_;
+}
+
+void OutputBuffer::MakeRoom(size_t len) {
+  if (len <= (size_t)(end_ - pos_))
+    return;
+  Flush();
+  if (len <= (size_t)(end_ - pos_))
+    return;
+  // Still not enough, so grow (only possible to happen for file output if
+  // someone asks for more than our buffer size).
+  assert(!writer_);  // Appending more than fits is done in chunks.
+  const size_t used = pos_ - buffer_;
+  size_t new_size = 2 * (end_ - buffer_);
+  while (new_size < used + len) new_size *= 2;
+  char *new_buffer = new char[new_size];
+  memcpy(new_buffer, buffer_, used);
+  delete [] buffer_;
+  buffer_ = new_buffer;
+  end_ = buffer_ + new_size;
+  pos_ = buffer_ + used;
+}
+
+void OutputBuffer::Append(const char *data, size_t len) {
+  if (len > (size_t)(end_ - pos_)) {
+    if (fd_ >= 0 && len > (size_t)(end_ - buffer_)) {
+      Flush();
+      WriteFully(fd_, data, len);  // Bigger than our buffer: write directly.
+      return;
+    }
+    while (writer_ && len > (size_t)(end_ - pos_)) {
+      const size_t chunk = end_ - pos_;   // Fill up buffers one by one.
+      memcpy(pos_, data, chunk);
+      pos_ += chunk;
+      data += chunk;
+      len -= chunk;
+      Flush();
+    }
+    MakeRoom(len);
+  }
+  memcpy(pos_, data, len);
+  pos_ += len;
+}
+
+void OutputBuffer::Append(const char *str) {
+  Append(str, strlen(str));
+}
+
+bool RoundFixed(double value, int decimals, int64_t *result) {
+  static const double kScale[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6 };
+  const double scaled = fabs(value) * kScale[decimals];
+  double integral;
+  const double fraction = modf(scaled, &integral);
+
+  int64_t n;
+  // The multiplication above might be off by one ulp from the exact decimal
+  // value printf() would round. That only matters if we're close to the
+  // rounding point, or if the number is too large to keep error small; in
+  // these rare cases, just let printf() do the work.
+  if (scaled < 1e9 && fabs(fraction - 0.5) >= 1e-6) {
+    n = (int64_t) integral + (fraction > 0.5 ? 1 : 0);
+  } else {
+    if (!(scaled < 1e15))
+      return false;  // Larger than we care about, NaN or infinite.
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, fabs(value));
+    char *dot = strchr(buffer, '.');
+    if (dot) memmove(dot, dot + 1, strlen(dot));
+    n = strtoll(buffer, NULL, 10);
+  }
+  if (signbit(value)) {
+    if (n == 0)
+      return false;  // printf() would show as "-0.000"
+    n = -n;
+  }
+  *result = n;
+  return true;
+}
+
+void OutputBuffer::AppendScaled(int64_t value, int decimals) {
+  uint64_t n = value < 0 ? -(uint64_t)value : value;
+  char digits[32];
+  char *d = digits + sizeof(digits);
+  for (int i = 0; i < decimals; ++i) {
+    *--d = '0' + n % 10;
+    n /= 10;
+  }
+  if (decimals > 0) *--d = '.';
+  do {
+    *--d = '0' + n % 10;
+    n /= 10;
+  } while (n);
+  if (value < 0) *--d = '-';
+  Append(d, digits + sizeof(digits) - d);
+}
+
+void OutputBuffer::AppendFixed(double value, int decimals) {
+  int64_t n;
+  if (RoundFixed(value, decimals, &n)) {
+    AppendScaled(n, decimals);
+  } else {
+    Printf("%.*f", decimals, value);
+  }
+}
+
+void OutputBuffer::Printf(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  VPrintf(fmt, ap);
+  va_end(ap);
+}
+
+void OutputBuffer::VPrintf(const char *fmt, va_list ap) {
+  va_list ap_copy;
+  va_copy(ap_copy, ap);
+  int len = vsnprintf(pos_, end_ - pos_, fmt, ap_copy);
+  va_end(ap_copy);
+  if (len < 0)
+    return;
+  if (len < end_ - pos_) {
+    pos_ += len;
+    return;
+  }
+  // Did not fit. Format in separate buffer.
+  std::vector<char> tmp(len + 1);
+  vsnprintf(tmp.data(), tmp.size(), fmt, ap);
+  Append(tmp.data(), len);
+}
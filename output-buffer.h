@@ -0,0 +1,92 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_OUTPUT_BUFFER_H_
+#define SHELL_EXTRUDE_OUTPUT_BUFFER_H_
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __GNUC__
+#  define PRINTF_FMT_CHECK(fmt_pos, args_pos) \
+      __attribute__ ((format (printf, fmt_pos, args_pos)))
+#else
+#  define PRINTF_FMT_CHECK(fmt_pos, args_pos)
+#endif
+
+// A large byte buffer that is written in bulk to a file descriptor.
+//
+// Printers emit one line per vertex per layer, so going through printf() for
+// each of them spends most of the time in stdio locking and generic double
+// formatting. The OutputBuffer instead provides a specialized fixed-point
+// number formatter that produces exactly the same bytes as printf("%.3f").
+class BackgroundWriter;
+
+class OutputBuffer {
+public:
+  // Output to file descriptor "fd" with a buffer of "buffer_size" bytes.
+  explicit OutputBuffer(int fd, size_t buffer_size = (1 << 20));
+
+  // In-memory buffer that grows as needed. Content is accessible with
+  // data() and size() and is never written anywhere.
+  OutputBuffer();
+
+  // Output via the background "writer", which is not owned and needs to
+  // outlive this OutputBuffer. Uses the buffers of the writer.
+  explicit OutputBuffer(BackgroundWriter *writer);
+
+  ~OutputBuffer();   // Flushes remaining content.
+
+  void Append(const char *str);
+  void Append(const char *data, size_t len);
+  void Append(char c) {
+    if (pos_ == end_) MakeRoom(1);
+    *pos_++ = c;
+  }
+
+  // Append number with the given number of decimals (0..6). Output is
+  // the same as printf("%.*f", decimals, value).
+  void AppendFixed(double value, int decimals);
+
+  // Append integer "value" in units of 10^-decimals, e.g. 1234 with
+  // 3 decimals is printed as 1.234. The counterpart of RoundFixed().
+  void AppendScaled(int64_t value, int decimals);
+
+  // Generic formatting for the less frequent cases.
+  void Printf(const char *fmt, ...) PRINTF_FMT_CHECK(2, 3);
+  void VPrintf(const char *fmt, va_list ap);
+
+  // Write everything buffered so far to the file descriptor or pass on to
+  // the background writer. No-op for in-memory buffers.
+  void Flush();
+
+  // Content not flushed yet; for in-memory buffers that is all of it.
+  const char *data() const { return buffer_; }
+  size_t size() const { return pos_ - buffer_; }
+  void Clear() { pos_ = buffer_; }
+
+private:
+  OutputBuffer(const OutputBuffer &);   // Not copyable.
+  void operator=(const OutputBuffer &);
+
+  // Make sure there are at least "len" bytes available, if possible by
+  // flushing, or growing if this is an in-memory buffer.
+  void MakeRoom(size_t len);
+
+  const int fd_;    // -1 for in-memory buffer or background writer.
+  BackgroundWriter *const writer_;
+  char *buffer_;
+  char *end_;
+  char *pos_;
+};
+
+// Round "value" to an integer in units of 10^-decimals exactly like
+// printf("%.*f") would. Returns false if the result can't be represented as
+// such integer, e.g. because printf() would print a negative zero.
+bool RoundFixed(double value, int decimals, int64_t *result);
+
+#undef PRINTF_FMT_CHECK
+
+#endif  // SHELL_EXTRUDE_OUTPUT_BUFFER_H_
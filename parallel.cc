@@ -0,0 +1,28 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "parallel.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+void ParallelFor(int count, int jobs, const std::function<void(int)> &fun) {
+  if (jobs > count) jobs = count;
+  if (jobs <= 1) {
+    for (int i = 0; i < count; ++i) fun(i);
+    return;
+  }
+  // Work is typically of very different size, so threads pick the next
+  // index when they're done instead of getting a fixed range.
+  std::atomic<int> next(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < jobs; ++t) {
+    threads.push_back(std::thread([&]() {
+          for (int i = next++; i < count; i = next++) fun(i);
+        }));
+  }
+  for (std::thread &t : threads) t.join();
+}
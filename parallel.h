@@ -0,0 +1,15 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_PARALLEL_H_
+#define SHELL_EXTRUDE_PARALLEL_H_
+
+#include <functional>
+
+// Call "fun" for each index in [0, count) using up to "jobs" threads.
+// Returns when all are done. With jobs <= 1, simply runs in the calling
+// thread in order.
+void ParallelFor(int count, int jobs, const std::function<void(int)> &fun);
+
+#endif  // SHELL_EXTRUDE_PARALLEL_H_
@@ -0,0 +1,37 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+// Convert a text or SVG polygon file to the binary polygon format (see
+// polygon-file.h), which multi-shell-extrude --polygon-file loads much
+// faster for large polygons.
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "polygon-file.h"
+
+// SVG curves are flattened to this, in units of the file.
+static const double kCurveTolerance = 0.001;
+
+int main(int argc, char *argv[]) {
+  if (argc > 2 || isatty(STDOUT_FILENO)) {
+    fprintf(stderr, "usage: %s [polygon-file] > out.polyb\n"
+            "Reads from stdin if no file given, writes the binary polygon "
+            "to stdout. SVG curves are flattened to within %g units.\n",
+            argv[0], kCurveTolerance);
+    return 1;
+  }
+  std::vector<Vector2D> vertices;
+  if (!ReadPolygonVertices(argc == 2 ? argv[1] : "-", kCurveTolerance,
+                           &vertices))
+    return 1;
+  if (!WritePolygonBinary(vertices, stdout) || fflush(stdout) != 0) {
+    perror("Writing binary polygon");
+    return 1;
+  }
+  return 0;
+}
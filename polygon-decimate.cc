@@ -0,0 +1,88 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "multi-shell-extrude.h"
+
+#include <math.h>
+
+#include <utility>
+#include <vector>
+
+// Distance of "p" from the line segment "a" to "b".
+static double SegmentDistance(const Vector2D &p,
+                              const Vector2D &a, const Vector2D &b) {
+  const double dx = b.x - a.x, dy = b.y - a.y;
+  const double len_sq = dx * dx + dy * dy;
+  double t = 0;
+  if (len_sq > 0) {
+    t = ((p.x - a.x) * dx + (p.y - a.y) * dy) / len_sq;
+    if (t < 0) t = 0;
+    if (t > 1) t = 1;
+  }
+  return distance(p.x - (a.x + t * dx), p.y - (a.y + t * dy), 0);
+}
+
+// Douglas-Peucker between "first" and "last": mark all points to keep
+// that are needed to stay within "tolerance".
+static void DouglasPeucker(const std::vector<Vector2D> &points,
+                           int first, int last, double tolerance,
+                           std::vector<bool> *keep) {
+  std::vector<std::pair<int, int> > todo;
+  todo.push_back(std::make_pair(first, last));
+  while (!todo.empty()) {
+    const int start = todo.back().first;
+    const int end = todo.back().second;
+    todo.pop_back();
+    double max_dist = 0;
+    int max_index = -1;
+    for (int i = start + 1; i < end; ++i) {
+      const double d = SegmentDistance(points[i], points[start], points[end]);
+      if (d > max_dist) {
+        max_dist = d;
+        max_index = i;
+      }
+    }
+    if (max_dist > tolerance) {
+      (*keep)[max_index] = true;
+      todo.push_back(std::make_pair(start, max_index));
+      todo.push_back(std::make_pair(max_index, end));
+    }
+  }
+}
+
+Polygon DecimatePolygon(const Polygon &polygon, double tolerance,
+                        double min_segment_len) {
+  const int n = polygon.size();
+  if (n < 4)
+    return polygon;
+  // Closed polygon: the path goes back to the first point at the end.
+  std::vector<Vector2D> points;
+  for (const FixedPoint &p : polygon) {
+    points.push_back(FromFixed(p));
+  }
+  points.push_back(points[0]);
+
+  // Points in between long segments are kept. Runs of short segments, that
+  // would exceed the segment rate, are simplified.
+  std::vector<bool> keep(n + 1, true);
+  int run_start = 0;
+  for (int i = 1; i <= n; ++i) {
+    const bool is_short = (points[i] - points[i-1]).magnitude() < min_segment_len;
+    if (is_short && i < n)
+      continue;
+    const int run_end = is_short ? i : i - 1;
+    if (run_end - run_start >= 2) {
+      for (int j = run_start + 1; j < run_end; ++j) keep[j] = false;
+      DouglasPeucker(points, run_start, run_end, tolerance, &keep);
+    }
+    run_start = i;
+  }
+
+  Polygon result;
+  for (int i = 0; i < n; ++i) {
+    if (keep[i]) result.push_back(polygon[i]);
+  }
+  return result;
+}
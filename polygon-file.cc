@@ -0,0 +1,357 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "polygon-file.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "svg-path.h"
+
+static const char kBinaryMagic[8] = { 'P','O','L','Y','B','0','1','\n' };
+static const size_t kBinaryHeaderSize = sizeof(kBinaryMagic) + 8;
+
+static uint64_t GetLE64(const char *in) {
+  uint64_t result = 0;
+  for (int i = 7; i >= 0; --i) {
+    result = (result << 8) | (unsigned char) in[i];
+  }
+  return result;
+}
+
+static void PutLE64(uint64_t value, char *out) {
+  for (int i = 0; i < 8; ++i) {
+    out[i] = value & 0xff;
+    value >>= 8;
+  }
+}
+
+namespace {
+// Content of a file: memory mapped if possible, otherwise (e.g. stdin or
+// pipes) read into memory.
+class FileContent {
+public:
+  FileContent() : data_(NULL), size_(0), mapped_(false) {}
+  ~FileContent() {
+    if (mapped_) munmap((void*) data_, size_);
+  }
+
+  // Returns false if the file can't be read.
+  bool Read(const std::string &filename) {
+    const bool is_stdin = (filename == "-");
+    const int fd = is_stdin ? STDIN_FILENO : open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped != MAP_FAILED) {
+        madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+        data_ = (const char*) mapped;
+        size_ = st.st_size;
+        mapped_ = true;
+      }
+    }
+    bool success = true;
+    if (!mapped_) {
+      char buffer[65536];
+      ssize_t r;
+      while ((r = read(fd, buffer, sizeof(buffer))) > 0) {
+        buffer_.append(buffer, r);
+      }
+      success = (r == 0);
+      data_ = buffer_.data();
+      size_ = buffer_.size();
+    }
+    if (!is_stdin) close(fd);
+    return success;
+  }
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const char *data_;
+  size_t size_;
+  bool mapped_;
+  std::string buffer_;
+};
+}  // namespace
+
+// Powers of ten that are exact as double.
+static const double kPow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Parse a number at "*pos", not going beyond "end", to "result" the way
+// strtod() does. Skips leading blanks. Returns false if there is no number.
+// Decimal numbers with up to 15 significant digits and small exponents -
+// such as the coordinates with a few decimals in a polygon file - are exact
+// as double, so need only one exact multiplication or division (which is then
+// correctly rounded); others are left to strtod().
+static bool ParseDouble(const char **pos, const char *end, double *result) {
+  const char *p = *pos;
+  while (p < end && isspace((unsigned char)*p))
+    ++p;
+  const char *const start = p;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    ++p;
+  }
+  uint64_t mantissa = 0;
+  int digits = 0;       // Significant digits in mantissa.
+  int exponent = 0;
+  bool any_digit = false;
+  for (/**/; p < end && isdigit((unsigned char)*p); ++p) {
+    any_digit = true;
+    if (mantissa == 0 && *p == '0') continue;
+    mantissa = mantissa * 10 + (*p - '0');
+    ++digits;
+  }
+  if (p < end && *p == '.') {
+    for (++p; p < end && isdigit((unsigned char)*p); ++p) {
+      any_digit = true;
+      if (mantissa == 0 && *p == '0') {
+        --exponent;
+        continue;
+      }
+      mantissa = mantissa * 10 + (*p - '0');
+      ++digits;
+      --exponent;
+    }
+  }
+  if (any_digit && p < end && (*p == 'e' || *p == 'E')) {
+    const char *e = p + 1;
+    bool negative_exponent = false;
+    if (e < end && (*e == '-' || *e == '+')) {
+      negative_exponent = (*e == '-');
+      ++e;
+    }
+    if (e < end && isdigit((unsigned char)*e)) {   // Else the 'e' isn't ours.
+      int value = 0;
+      for (/**/; e < end && isdigit((unsigned char)*e); ++e) {
+        if (value < 10000) value = value * 10 + (*e - '0');
+      }
+      exponent += negative_exponent ? -value : value;
+      p = e;
+    }
+  }
+  // Hexadecimal, infinity and such, or too many digits: strtod() knows.
+  const bool is_special = (p < end && isalpha((unsigned char)*p));
+  if (any_digit && !is_special && digits <= 15
+      && exponent >= -22 && exponent <= 22) {
+    double value = mantissa;
+    value = (exponent < 0) ? value / kPow10[-exponent]
+      : value * kPow10[exponent];
+    *result = negative ? -value : value;
+    *pos = p;
+    return true;
+  }
+  const char *token_end = start;
+  while (token_end < end && !isspace((unsigned char)*token_end))
+    ++token_end;
+  const std::string token(start, token_end);
+  char *parsed_end;
+  *result = strtod(token.c_str(), &parsed_end);
+  if (parsed_end == token.c_str())
+    return false;
+  *pos = start + (parsed_end - token.c_str());
+  return true;
+}
+
+// Parse text polygon: essentially a sequence of x y coordinates.
+static void ParseTextPolygon(const std::string &filename,
+                             const char *data, size_t size,
+                             std::vector<Vector2D> *polygon) {
+  const char *const end = data + size;
+  // Most lines are vertices.
+  size_t lines = 0;
+  for (const char *p = data; (p = (const char*) memchr(p, '\n', end - p));
+       ++p) {
+    ++lines;
+  }
+  polygon->reserve(lines + 1);
+  int line = 0;
+  for (const char *pos = data; pos < end; /**/) {
+    const char *eol = (const char*) memchr(pos, '\n', end - pos);
+    if (eol == NULL) eol = end;
+    ++line;
+    const char *start = pos;
+    while (start < eol && isspace((unsigned char)*start))
+      start++;
+    pos = eol + 1;
+    if (start == eol || *start == '#')
+      continue;
+    const char *p = start;
+    Vector2D v;
+    if (ParseDouble(&p, eol, &v.x) && ParseDouble(&p, eol, &v.y)) {
+      polygon->push_back(v);
+    } else {
+      while (eol > start && isspace((unsigned char)eol[-1]))
+        --eol;
+      fprintf(stderr, "%s:%d not a comment and not coordinates: '%.*s'\n",
+              filename.c_str(), line, (int)(eol - start), start);
+    }
+  }
+}
+
+static bool ParseBinaryPolygon(const std::string &filename,
+                               const char *data, size_t size,
+                               std::vector<Vector2D> *polygon) {
+  const uint64_t count = GetLE64(data + sizeof(kBinaryMagic));
+  if (count > (size - kBinaryHeaderSize) / (2 * sizeof(double))
+      || size != kBinaryHeaderSize + count * 2 * sizeof(double)) {
+    fprintf(stderr, "%s: broken binary polygon file: %llu vertices in "
+            "%zu bytes\n", filename.c_str(), (unsigned long long)count, size);
+    return false;
+  }
+  polygon->resize(count);
+  const char *in = data + kBinaryHeaderSize;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  static_assert(sizeof(Vector2D) == 2 * sizeof(double), "Vector2D layout");
+  memcpy(polygon->data(), in, count * sizeof(Vector2D));
+#else
+  for (Vector2D &v : *polygon) {
+    const uint64_t x = GetLE64(in), y = GetLE64(in + 8);
+    memcpy(&v.x, &x, sizeof(double));
+    memcpy(&v.y, &y, sizeof(double));
+    in += 16;
+  }
+#endif
+  return true;
+}
+
+namespace {
+// Content of a polygon file: either the vertices, or the path data of an
+// SVG file, which is flattened depending on the needed accuracy.
+struct PolygonFile {
+  std::vector<Vector2D> vertices;
+  std::string svg_path;
+};
+}  // namespace
+
+static bool LoadPolygonFile(const std::string &filename, PolygonFile *file) {
+  FileContent content;
+  if (!content.Read(filename)) {
+    fprintf(stderr, "Can't open %s\n", filename.c_str());
+    return false;
+  }
+  if (content.size() >= kBinaryHeaderSize
+      && memcmp(content.data(), kBinaryMagic, sizeof(kBinaryMagic)) == 0) {
+    return ParseBinaryPolygon(filename, content.data(), content.size(),
+                              &file->vertices);
+  }
+  const char *first = content.data();
+  const char *const end = content.data() + content.size();
+  while (first < end && isspace((unsigned char)*first)) ++first;
+  if (first < end && *first == '<') {
+    if (!FindSvgPath(content.data(), content.size(), &file->svg_path)) {
+      fprintf(stderr, "%s: no <path> with path data found.\n",
+              filename.c_str());
+      return false;
+    }
+    return true;
+  }
+  ParseTextPolygon(filename, content.data(), content.size(), &file->vertices);
+  return true;
+}
+
+static bool GetVertices(const PolygonFile &file, double curve_tolerance,
+                        std::vector<Vector2D> *vertices) {
+  if (file.svg_path.empty()) {
+    *vertices = file.vertices;
+    return true;
+  }
+  return SvgPathToPolygon(file.svg_path, curve_tolerance, vertices);
+}
+
+bool ReadPolygonVertices(const std::string &filename, double curve_tolerance,
+                         std::vector<Vector2D> *vertices) {
+  vertices->clear();
+  PolygonFile file;
+  return (LoadPolygonFile(filename, &file)
+          && GetVertices(file, curve_tolerance, vertices));
+}
+
+bool WritePolygonBinary(const std::vector<Vector2D> &vertices, FILE *out) {
+  char count[8];
+  PutLE64(vertices.size(), count);
+  bool success = (fwrite(kBinaryMagic, sizeof(kBinaryMagic), 1, out) == 1
+                  && fwrite(count, sizeof(count), 1, out) == 1);
+  for (size_t i = 0; success && i < vertices.size(); ++i) {
+    uint64_t x, y;
+    memcpy(&x, &vertices[i].x, sizeof(double));
+    memcpy(&y, &vertices[i].y, sizeof(double));
+    char bytes[16];
+    PutLE64(x, bytes);
+    PutLE64(y, bytes + 8);
+    success = (fwrite(bytes, sizeof(bytes), 1, out) == 1);
+  }
+  return success;
+}
+
+// Polygon from file, scaled by "factor". Files are only read once, as
+// jobs of a batch often use the same. Files that fail to load are not kept,
+// so later jobs try again.
+Polygon ReadPolygon(const std::string &filename, double factor,
+                    double curve_tolerance) {
+  // Vertices and path data of all files kept; cleared if more than 64MB.
+  static const size_t kMaxBytes = 64 << 20;
+  static std::mutex mutex;
+  static std::map<std::string, std::shared_ptr<const PolygonFile> > files;
+  static size_t bytes = 0;
+  std::shared_ptr<const PolygonFile> loaded;
+  {
+    std::lock_guard<std::mutex> l(mutex);
+    auto found = files.find(filename);
+    if (found != files.end()) {
+      loaded = found->second;
+    } else {
+      std::shared_ptr<PolygonFile> file(new PolygonFile());
+      if (LoadPolygonFile(filename, file.get())) {
+        const size_t file_bytes = (file->vertices.size() * sizeof(Vector2D)
+                                   + file->svg_path.size());
+        if (file_bytes <= kMaxBytes) {
+          if (bytes + file_bytes > kMaxBytes) {
+            files.clear();  // Simple way to keep memory bounded.
+            bytes = 0;
+          }
+          files[filename] = file;
+          bytes += file_bytes;
+        }
+      }
+      loaded = file;
+    }
+  }
+  // Kept alive by "loaded", even if removed from the files meanwhile.
+  const PolygonFile &file = *loaded;
+  std::vector<Vector2D> svg_vertices;
+  if (!file.svg_path.empty()) {
+    // Tolerance in mm is in file units before scaling.
+    GetVertices(file, curve_tolerance / factor, &svg_vertices);
+  }
+  const std::vector<Vector2D> &vertices
+    = file.svg_path.empty() ? file.vertices : svg_vertices;
+  Polygon polygon;
+  polygon.reserve(vertices.size());
+  for (const Vector2D &p : vertices) {
+    polygon.push_back(ToFixed(Vector2D(p.x * factor, p.y * factor)));
+  }
+  return polygon;
+}
@@ -0,0 +1,41 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_POLYGON_FILE_H_
+#define SHELL_EXTRUDE_POLYGON_FILE_H_
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "multi-shell-extrude.h"
+
+// Polygon files come in three formats, recognized by their content:
+//
+// Text: one vertex per line as "x y" coordinates in mm. Empty lines and lines
+// starting with '#' are ignored.
+//
+// Binary (.polyb), for large polygons that should load fast:
+//   8 bytes   magic "POLYB01\n"
+//   uint64    number of vertices n
+//   n times   double x, double y
+// All numbers little endian; doubles IEEE 754.
+//
+// SVG: recognized by starting with '<'. The first <path> element is used;
+// see SvgPathToPolygon().
+
+// Read the vertices of polygon file "filename"; "-" reads from stdin.
+// Curves in SVG files are flattened to within "curve_tolerance", in units of
+// the file.
+// Returns false, after printing why, if the file can't be read.
+// Text lines that are not coordinates are reported and skipped.
+bool ReadPolygonVertices(const std::string &filename, double curve_tolerance,
+                         std::vector<Vector2D> *vertices);
+
+// Write "vertices" in the binary polygon format to "out".
+// Returns false on write error.
+bool WritePolygonBinary(const std::vector<Vector2D> &vertices, FILE *out);
+
+#endif  // SHELL_EXTRUDE_POLYGON_FILE_H_
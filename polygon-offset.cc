@@ -6,10 +6,18 @@
 #include "multi-shell-extrude.h"
 
 #include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
 
 // Offset using the clipper library.
 // http://www.angusj.com/delphi/clipper/documentation/Docs/Units/ClipperLib/Classes/ClipperOffset/_Body.htm
 
+#include "parallel.h"
 #include "third_party/clipper.hpp"
 
 // A path is centered if the rectangle aorund it is covering the centroid.
@@ -26,24 +34,28 @@ static bool is_centered(const Vector2D &centroid, const ClipperLib::Path &path)
           && min_y < centroid.y && max_y > centroid.y);
 }
 
-Polygon PolygonOffset(const Polygon &polygon, double offset,
-                      OffsetType type) {
-  // Converting float to clipper integer values. Make sure
-  // to stay within limits.
-  const float kResolution = 1e4;
-  const float kAccuracy = 0.01; // mm : cutting corners with this accuracy
+namespace {
+const double kAccuracy = 0.01; // mm : cutting corners with this accuracy
 
-  ClipperLib::Path path;
-  Vector2D centroid;
-  for (const Vector2D &p : polygon) {
-    Vector2D clipper_point = p * kResolution;
-    path.push_back(ClipperLib::IntPoint(clipper_point.x, clipper_point.y));
-    centroid = centroid + clipper_point;
+// Our fixed point polygon as clipper path; also determines the "centroid".
+ClipperLib::Path ToPath(const Polygon &polygon, Vector2D *centroid) {
+  ClipperLib::Path path(polygon.size());
+  Vector2D sum;
+  for (size_t i = 0; i < polygon.size(); ++i) {
+    path[i] = ClipperLib::IntPoint(polygon[i].x, polygon[i].y);
+    sum = sum + Vector2D(polygon[i].x, polygon[i].y);
   }
-  centroid = centroid / polygon.size();
+  *centroid = sum / polygon.size();
+  return path;
+}
 
+// Offset the path. A polygon might become pieces when offset; we return
+// the one that is centered around "centroid". Empty if nothing left.
+ClipperLib::Path OffsetPath(const ClipperLib::Path &path,
+                            const Vector2D &centroid, double offset,
+                            OffsetType type) {
   ClipperLib::Paths solutions;
-  ClipperLib::ClipperOffset co(2.0, kAccuracy * kResolution);
+  ClipperLib::ClipperOffset co(2.0, kAccuracy * kFixedPointScale);
   ClipperLib::JoinType join = ClipperLib::jtRound;
   switch (type) {
   case kOffsetRound:  join = ClipperLib::jtRound; break;
@@ -51,10 +63,10 @@ Polygon PolygonOffset(const Polygon &polygon, double offset,
   case kOffsetMiter:  join = ClipperLib::jtMiter; break;
   }
   co.AddPath(path, join, ClipperLib::etClosedPolygon);
-  co.Execute(solutions, kResolution * offset);
+  co.Execute(solutions, kFixedPointScale * offset);
 
   if (solutions.size() == 0)  // Nothing left.
-    return Polygon();
+    return ClipperLib::Path();
 
   // A polygon might become pieces when offset. Use the one that is centered.
   ClipperLib::Path &centered_polygon = solutions[0];
@@ -64,41 +76,208 @@ Polygon PolygonOffset(const Polygon &polygon, double offset,
       break;
     }
   }
+  return centered_polygon;
+}
 
-  Polygon tmp;
-  for (const ClipperLib::IntPoint &p : centered_polygon) {
-    tmp.push_back(Vector2D(p.X / kResolution, p.Y / kResolution));
-  }
-
+// Convert back from clipper path to polygon, starting at the point closest
+// to "reference".
+Polygon ToPolygon(const ClipperLib::Path &path, const FixedPoint &reference) {
   // The way the clipper library works, the offset polygon might start at a
   // different point - after all, it is a different polygon.
-  // Let's try to find the one that is closest to the start of the input polygon
-  // by looking for the closest point to the line represented by the start-vector,
-  // i.e. closest point in the same direction.
-  const Vector2D &reference = polygon[0];
-  double smallest = -1;
+  // Let's try to find the one that is closest to the start of the input
+  // polygon.
+  // TODO: find the closest point in the same direction from the center.
+  int64_t smallest = -1;
   std::size_t offset_index = 0;
-  for (std::size_t i = 0; i < tmp.size(); ++i) {
-    const Vector2D &p = tmp[i];
-#if 0
-    // TODO: find center and make line relative to that.
-    // Then use http://en.wikipedia.org/wiki/Distance_from_a_point_to_a_line#Line_defined_by_two_points
-    const double dist = abs(reference.y * p.x - reference.x * p.y);
-    const bool same_side = (reference.x * p.x >= 0) && (reference.y * p.y >= 0);
-#else
-    const double dist = distance(p.x - reference.x, p.y - reference.y, 0);
-    const bool same_side = true;
-#endif
-    if (i == 0 || (dist < smallest && same_side)) {
+  for (std::size_t i = 0; i < path.size(); ++i) {
+    const int64_t dx = path[i].X - reference.x;
+    const int64_t dy = path[i].Y - reference.y;
+    const int64_t dist_sq = dx * dx + dy * dy;
+    if (i == 0 || dist_sq < smallest) {
       offset_index = i;
-      smallest = dist;
+      smallest = dist_sq;
     }
   }
 
   // .. then create the result by shifting that.
+  Polygon result(path.size());
+  for (std::size_t i = 0; i < path.size(); ++i) {
+    const ClipperLib::IntPoint &p = path[(i + offset_index) % path.size()];
+    result[i] = FixedPoint(p.X, p.Y);
+  }
+  return result;
+}
+}  // namespace
+
+static Polygon ComputePolygonOffset(const Polygon &polygon, double offset,
+                                   OffsetType type) {
+  Vector2D centroid;
+  const ClipperLib::Path path = ToPath(polygon, &centroid);
+  const ClipperLib::Path result = OffsetPath(path, centroid, offset, type);
+  if (result.empty())
+    return Polygon();
+  return ToPolygon(result, polygon[0]);
+}
+
+// The same offsets are needed multiple times while planning and printing
+// (e.g. bed layout and screw itself), so we remember results.
+namespace {
+struct CacheEntry {
+  Polygon polygon;
+  double offset;
+  OffsetType type;
   Polygon result;
-  for (std::size_t i = 0; i < tmp.size(); ++i) {
-    result.push_back(tmp[(i + offset_index) % tmp.size()]);
+};
+
+class OffsetCache {
+public:
+  OffsetCache() : vertices_(0), hits_(0), misses_(0) {}
+
+  bool Lookup(uint64_t key, const Polygon &polygon, double offset,
+              OffsetType type, Polygon *result) {
+    std::lock_guard<std::mutex> l(mutex_);
+    auto range = entries_.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+      const CacheEntry &e = it->second;
+      if (e.offset == offset && e.type == type
+          && e.polygon.size() == polygon.size()
+          && memcmp(e.polygon.data(), polygon.data(),
+                    polygon.size() * sizeof(FixedPoint)) == 0) {
+        *result = e.result;
+        ++hits_;
+        return true;
+      }
+    }
+    ++misses_;
+    return false;
+  }
+
+  void Insert(uint64_t key, const Polygon &polygon, double offset,
+              OffsetType type, const Polygon &result) {
+    const size_t vertices = polygon.size() + result.size();
+    if (vertices > kMaxVertices)
+      return;   // Would push out everything else.
+    std::lock_guard<std::mutex> l(mutex_);
+    if (vertices_ + vertices > kMaxVertices) {
+      entries_.clear();  // Simple way to keep memory bounded.
+      vertices_ = 0;
+    }
+    entries_.insert(std::make_pair(key, CacheEntry{polygon, offset, type,
+                                                   result}));
+    vertices_ += vertices;
+  }
+
+  PolygonOffsetCacheStats stats() {
+    std::lock_guard<std::mutex> l(mutex_);
+    return { hits_, misses_ };
+  }
+
+private:
+  // Polygons and results of all entries; 16 bytes each, so 64MB.
+  static const size_t kMaxVertices = 4 << 20;
+  std::mutex mutex_;
+  std::unordered_multimap<uint64_t, CacheEntry> entries_;
+  size_t vertices_;
+  int hits_;
+  int misses_;
+};
+
+OffsetCache *GetCache() {
+  static OffsetCache *cache = new OffsetCache();
+  return cache;
+}
+
+// FNV-1a over the bytes.
+uint64_t Hash(const void *data, size_t len, uint64_t hash) {
+  const unsigned char *bytes = (const unsigned char*) data;
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Cache key is the hash of the polygon, continued with offset and type.
+uint64_t PolygonKey(const Polygon &polygon) {
+  return Hash(polygon.data(), polygon.size() * sizeof(FixedPoint),
+              14695981039346656037ULL);
+}
+uint64_t OffsetKey(uint64_t polygon_key, double offset, OffsetType type) {
+  const uint64_t key = Hash(&offset, sizeof(offset), polygon_key);
+  return Hash(&type, sizeof(type), key);
+}
+}  // namespace
+
+Polygon PolygonOffset(const Polygon &polygon, double offset,
+                      OffsetType type) {
+  const uint64_t key = OffsetKey(PolygonKey(polygon), offset, type);
+  Polygon result;
+  if (GetCache()->Lookup(key, polygon, offset, type, &result))
+    return result;
+  result = ComputePolygonOffset(polygon, offset, type);
+  GetCache()->Insert(key, polygon, offset, type, result);
+  return result;
+}
+
+PolygonOffsetCacheStats GetPolygonOffsetCacheStats() {
+  return GetCache()->stats();
+}
+
+// Offsetting an offset polygon is the same as offsetting the original by the
+// sum of both, as long as both go in the same direction (e.g. growing a
+// grown polygon). Each step adds its own approximation of round corners, so
+// we only derive a limited number of rings from each other; these chains of
+// rings are independent of each other and computed in parallel.
+std::vector<Polygon> PolygonOffsetLadder(const Polygon &polygon,
+                                         const std::vector<double> &offsets,
+                                         bool derive, OffsetType type,
+                                         int jobs) {
+  static const int kChainLength = 4;
+  const int count = offsets.size();
+  std::vector<Polygon> result(count);
+  if (polygon.empty())
+    return result;
+  Vector2D centroid;
+  const ClipperLib::Path path = ToPath(polygon, &centroid);
+  if (!derive) {
+    // Rings are the same as from PolygonOffset(), so they are shared with
+    // its cache, e.g. between prints of a batch that use the same polygon.
+    const uint64_t polygon_key = PolygonKey(polygon);
+    ParallelFor(count, jobs, [&](int i) {
+        const uint64_t key = OffsetKey(polygon_key, offsets[i], type);
+        if (GetCache()->Lookup(key, polygon, offsets[i], type, &result[i]))
+          return;
+        const ClipperLib::Path ring = OffsetPath(path, centroid, offsets[i],
+                                                 type);
+        if (!ring.empty())
+          result[i] = ToPolygon(ring, polygon[0]);
+        GetCache()->Insert(key, polygon, offsets[i], type, result[i]);
+      });
+    return result;
   }
+  const int chains = (count + kChainLength - 1) / kChainLength;
+  ParallelFor(chains, jobs, [&](int chain) {
+      // Derive from the ring closest to the original polygon outwards.
+      std::vector<int> order;
+      for (int i = chain * kChainLength;
+           i < std::min((chain + 1) * kChainLength, count); ++i) {
+        order.push_back(i);
+      }
+      std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+          return fabs(offsets[a]) < fabs(offsets[b]);
+        });
+      ClipperLib::Path ring;
+      double previous = 0;
+      for (int i : order) {
+        const double step = offsets[i] - previous;
+        const bool can_derive = derive && !ring.empty()
+          && ((previous >= 0 && step >= 0) || (previous <= 0 && step <= 0));
+        ring = can_derive
+          ? OffsetPath(ring, centroid, step, type)
+          : OffsetPath(path, centroid, offsets[i], type);
+        previous = offsets[i];
+        if (!ring.empty())
+          result[i] = ToPolygon(ring, polygon[0]);
+      }
+    });
   return result;
 }
@@ -9,59 +9,72 @@
 #include <stdarg.h>
 #include <assert.h>
 
+#include <algorithm>
+#include <string>
+
+#include "binary-gcode.h"
+#include "motion-planner.h"
 #include "multi-shell-extrude.h"  // for distance()
+#include "output-buffer.h"
 
 namespace {
 class GCodePrinter : public Printer {
 public:
-  GCodePrinter(double extrusion_factor, double retract_amount,
-               double temperature, double bed_temp)
-    : filament_extrusion_factor_(extrusion_factor),
-      retract_amount_(retract_amount), current_feedrate_(-1),
-      temperature_(temperature), bed_temp_(bed_temp), extrude_dist_(0) {}
+  // Writes to "out", which we take ownership of.
+  GCodePrinter(OutputBuffer *out, double extrusion_factor,
+               double retract_amount, double temperature, double bed_temp,
+               double max_e_feedrate, const MotionLimits &motion_limits)
+    : out_(out), filament_extrusion_factor_(extrusion_factor),
+      retract_amount_(retract_amount), max_e_feedrate_(max_e_feedrate),
+      current_feedrate_(-1), requested_feedrate_(-1),
+      temperature_(temperature), bed_temp_(bed_temp), extrude_dist_(0),
+      flow_limited_moves_(0),
+      motion_limits_(motion_limits), planner_(motion_limits) {}
+  virtual ~GCodePrinter() { delete out_; }
 
   virtual void Preamble(const Vector2D &machine_limit,
                         double feed_mm_per_sec) {
-    printf("(G-Code)\n\n");
+    out_->Append("(G-Code)\n\n");
   }
 
   virtual void Init(const Vector2D &machine_limit,
                     double feed_mm_per_sec) {
-    printf("G28\nG1 F%.1f\n", feed_mm_per_sec * 60);
-    printf("G1 Z5\n");
-    printf("M82      ; absolute E\n"
-           "G92 E0.0 ; zero E\n");
+    out_->Printf("G28\nG1 F%.1f\n", feed_mm_per_sec * 60);
+    out_->Append("G1 Z5\n");
+    out_->Append("M82      ; absolute E\n"
+                 "G92 E0.0 ; zero E\n");
     const bool with_heated_bed = bed_temp_ > 0 && bed_temp_ < 120;
     if (with_heated_bed) {
-      printf("M140 S%.0f  ; not waiting for it yet\n", bed_temp_);
+      out_->Printf("M140 S%.0f  ; not waiting for it yet\n", bed_temp_);
     }
 
     // Bed leveling
-    printf("\n");
+    out_->Append("\n");
     Comment("Bed leveling\n");
-    printf("M84 E         ; turn off e motor\n");
-    printf("M109 S170     ; min temperature not have soft nozzle buggers\n");
-    printf("G1 E-2 F2400  ; retract to not ooze while bed leveling\n");
-    printf("M84 E\n");
-    printf("G28 Z0        ; Establish a general Z0\n");
-    printf("G29           ; bed levelling after everything is hot\n\n");
+    out_->Append("M84 E         ; turn off e motor\n");
+    out_->Append("M109 S170     ; min temperature not have soft nozzle buggers\n");
+    out_->Append("G1 E-2 F2400  ; retract to not ooze while bed leveling\n");
+    out_->Append("M84 E\n");
+    out_->Append("G28 Z0        ; Establish a general Z0\n");
+    out_->Append("G29           ; bed levelling after everything is hot\n\n");
 
     Comment("Wait for all temperatures reached\n");
-    printf("G1 E0\n");
-    printf("G0 X%.1f Y10 Z30 F6000 ; move to center front while heating\n",
-           machine_limit.x/2);
+    out_->Append("G1 E0\n");
+    out_->Printf("G0 X%.1f Y10 Z30 F6000 ; move to center front while heating\n",
+                 machine_limit.x/2);
+    planner_.MoveTo(machine_limit.x/2, 10, 30, 6000 / 60.0);
 
     SetTemperature(temperature_);
 
     // Waiting for temperature
-    printf("M109 S%.0f\n", temperature_);
+    out_->Printf("M109 S%.0f\n", temperature_);
     if (with_heated_bed) {
-      printf("M190 S%.0f ; wait for bed-temp\n", bed_temp_);
+      out_->Printf("M190 S%.0f ; wait for bed-temp\n", bed_temp_);
     }
 
-    printf("M82      ; absolute E\nG92 E0.0 ; zero E\n");
-    printf("G1 E3    ; squirt out some test in air\n"); // squirt out some test
-    printf("G92 E0.0\n\n; test extrusion...\n");
+    out_->Append("M82      ; absolute E\nG92 E0.0 ; zero E\n");
+    out_->Append("G1 E3    ; squirt out some test in air\n"); // squirt out some test
+    out_->Append("G92 E0.0\n\n; test extrusion...\n");
     const double test_extrusion_from = 0.5 * machine_limit.x;
     const double test_extrusion_to = 0.1 * machine_limit.x;
     SetSpeed(300.0);
@@ -75,110 +88,371 @@ public:
     GoZPos(5);
   }
   virtual void Postamble() {
-    printf("M104 S0 ; hotend off\n");
-    printf("M140 S0 ; heated bed off\n");
-    printf("M106 S0 ; fan off\n");
-    printf("G1 X0\n");  // We keep z-axis as is.
-    printf("G92 E0.0\n");
-    printf("M84\n");
+    out_->Append("M104 S0 ; hotend off\n");
+    out_->Append("M140 S0 ; heated bed off\n");
+    out_->Append("M106 S0 ; fan off\n");
+    out_->Append("G1 X0\n");  // We keep z-axis as is.
+    out_->Append("G92 E0.0\n");
+    out_->Append("M84\n");
+    out_->Flush();
   }
   virtual void SetTemperature(double temperature) {
     if (temperature != temperature_)
-      printf("M104 S%.0f\n", temperature);
+      out_->Printf("M104 S%.0f\n", temperature);
     temperature_ = temperature;
   }
   virtual double GetExtrusionDistance() { return extrude_dist_; }
+  virtual double GetPrintTime() { return planner_.GetTime(); }
+  virtual int GetFlowLimitedMoves() { return flow_limited_moves_; }
   virtual void Comment(const char *fmt, ...) {
-    printf("; ");   // TODO: not all printers might be able to deal with ';'
-    va_list ap; va_start(ap, fmt); vprintf(fmt, ap); va_end(ap);
+    out_->Append("; ");   // TODO: not all printers might be able to deal with ';'
+    va_list ap; va_start(ap, fmt); out_->VPrintf(fmt, ap); va_end(ap);
   }
 
   virtual void SetSpeed(double feed_mm_per_sec) {
-    if (feed_mm_per_sec != current_feedrate_) {
-      printf("G1 F%.1f  ; feedrate=%.1fmm/s\n", feed_mm_per_sec * 60,
-             feed_mm_per_sec);
-      current_feedrate_ = feed_mm_per_sec;
+    requested_feedrate_ = feed_mm_per_sec;
+    // With a flow limit, the feedrate depends on the move, so is only
+    // sent with the next one.
+    if (max_e_feedrate_ <= 0 && feed_mm_per_sec != current_feedrate_) {
+      EmitFeedrate(feed_mm_per_sec, false);
     }
   }
   virtual void GoZPos(double z) {
-    printf("G1 Z%.3f\n", z);
+    UseFeedrate(0);
+    EmitZMove(z);
+    planner_.MoveTo(last_x, last_y, z, current_feedrate_);
   }
   virtual void MoveTo(const Vector2D &pos, double z) {
-    printf("G1 X%.3f Y%.3f Z%.3f\n", pos.x, pos.y, z);
+    UseFeedrate(0);
+    EmitMove(pos, z);
+    planner_.MoveTo(pos.x, pos.y, z, current_feedrate_);
     last_x = pos.x; last_y = pos.y; last_z = z;
   }
   virtual void ExtrudeTo(const Vector2D &pos, double z,
                          double extrusion_multiplier) {
+    if (UseFeedrate(extrusion_multiplier)) ++flow_limited_moves_;
     extrude_dist_ += distance(pos.x - last_x, pos.y - last_y, z - last_z);
-    printf("G1 X%.3f Y%.3f Z%.3f E%.3f\n", pos.x, pos.y, z,
-           extrude_dist_ * filament_extrusion_factor_ * extrusion_multiplier);
+    EmitExtrude(pos, z, extrude_dist_ * filament_extrusion_factor_
+                * extrusion_multiplier);
+    planner_.MoveTo(pos.x, pos.y, z, current_feedrate_);
     last_x = pos.x; last_y = pos.y; last_z = z;
   }
+  virtual void ExtrudePath(const double *x, const double *y, const double *z,
+                           const double *segment_len, int count,
+                           double extrusion_multiplier) {
+    if (count > 0 && UseFeedrate(extrusion_multiplier))
+      flow_limited_moves_ += count;
+    for (int i = 0; i < count; ++i) {
+      extrude_dist_ += segment_len[i];
+      EmitExtrude(Vector2D(x[i], y[i]), z[i], extrude_dist_
+                  * filament_extrusion_factor_ * extrusion_multiplier);
+      planner_.MoveTo(x[i], y[i], z[i], current_feedrate_);
+    }
+    if (count > 0) {
+      last_x = x[count-1]; last_y = y[count-1]; last_z = z[count-1];
+    }
+  }
+  virtual void ExtrudeArc(const double *x, const double *y, const double *z,
+                          const double *segment_len, int count,
+                          const Vector2D &center, bool clockwise,
+                          double extrusion_multiplier) {
+    if (count <= 0) return;
+    if (UseFeedrate(extrusion_multiplier)) ++flow_limited_moves_;
+    // Same extrusion as the segments would get, so the E-axis is the
+    // same at the end of the arc. Firmware splits arcs into segments as
+    // well, so we plan them as such.
+    for (int i = 0; i < count; ++i) {
+      extrude_dist_ += segment_len[i];
+      planner_.MoveTo(x[i], y[i], z[i], current_feedrate_);
+    }
+    const Vector2D end(x[count-1], y[count-1]);
+    EmitArc(end, z[count-1], center - Vector2D(last_x, last_y), clockwise,
+            extrude_dist_ * filament_extrusion_factor_ * extrusion_multiplier);
+    last_x = end.x; last_y = end.y; last_z = z[count-1];
+  }
   virtual void ResetExtrude() {
     assert(in_retract_);
     in_retract_ = false;
-    printf("M83      ; relative E\n"  // extruder relative mode
-           "G1 E%.1f  ; filament back to nozzle tip\n"
-           "M82      ; absolute E\n", // extruder absolute mode
-           1.1 * retract_amount_);  // fudging... a bit more squeeze.
-    printf("G92 E0.0 ; start extrusion, set E to zero\n");
+    out_->Printf("M83      ; relative E\n"  // extruder relative mode
+                 "G1 E%.1f  ; filament back to nozzle tip\n"
+                 "M82      ; absolute E\n", // extruder absolute mode
+                 1.1 * retract_amount_);  // fudging... a bit more squeeze.
+    out_->Append("G92 E0.0 ; start extrusion, set E to zero\n");
     extrude_dist_ = 0;
+    planner_.Stop();   // Extruder-only moves.
   }
   virtual void Retract() {
     assert(!in_retract_);
-    printf("M83      ; relative E\n"
-           "G1 E%.1f ; retract\n"
-           "M82      ; Back to absolute\n", -retract_amount_);
+    out_->Printf("M83      ; relative E\n"
+                 "G1 E%.1f ; retract\n"
+                 "M82      ; Back to absolute\n", -retract_amount_);
     in_retract_ = true;
+    planner_.Stop();
   }
   virtual void SwitchFan(bool on) {
-    printf("M106 S%d\n", on ? 255 : 0);
+    out_->Append(on ? "M106 S255\n" : "M106 S0\n");
+  }
+
+  virtual Printer *CreateDetached() const {
+    GCodePrinter *result = new GCodePrinter(new OutputBuffer(),
+                                            filament_extrusion_factor_,
+                                            retract_amount_, temperature_,
+                                            bed_temp_, max_e_feedrate_,
+                                            motion_limits_);
+    result->CopyStateFrom(*this);
+    return result;
+  }
+  virtual bool SameState(const Printer &detached) const {
+    const GCodePrinter &other = static_cast<const GCodePrinter&>(detached);
+    // Position and extrusion distance are reset at the start of each screw.
+    return (current_feedrate_ == other.current_feedrate_
+            && requested_feedrate_ == other.requested_feedrate_
+            && temperature_ == other.temperature_
+            && in_retract_ == other.in_retract_);
+  }
+  virtual void AppendDetached(const Printer &detached) {
+    const GCodePrinter &other = static_cast<const GCodePrinter&>(detached);
+    out_->Append(other.out_->data(), other.out_->size());
+    CopyStateFrom(other);
+    planner_.Append(other.planner_);
+    flow_limited_moves_ += other.flow_limited_moves_;
+  }
+
+protected:
+  // Output of the movement commands, by far the most frequent GCode lines.
+  virtual void EmitZMove(double z) {
+    out_->Append("G1 Z");
+    out_->AppendFixed(z, 3);
+    out_->Append('\n');
+  }
+  virtual void EmitMove(const Vector2D &pos, double z) {
+    AppendXYZ(pos, z);
+    out_->Append('\n');
+  }
+  virtual void EmitExtrude(const Vector2D &pos, double z, double e) {
+    AppendXYZ(pos, z);
+    out_->Append(" E");
+    out_->AppendFixed(e, 3);
+    out_->Append('\n');
+  }
+
+  // Arc around "center_offset" relative to the current position.
+  virtual void EmitArc(const Vector2D &pos, double z,
+                       const Vector2D &center_offset, bool clockwise,
+                       double e) {
+    out_->Append(clockwise ? "G2 X" : "G3 X");
+    out_->AppendFixed(pos.x, 3);
+    out_->Append(" Y");
+    out_->AppendFixed(pos.y, 3);
+    out_->Append(" Z");
+    out_->AppendFixed(z, 3);
+    out_->Append(" I");
+    out_->AppendFixed(center_offset.x, 3);
+    out_->Append(" J");
+    out_->AppendFixed(center_offset.y, 3);
+    out_->Append(" E");
+    out_->AppendFixed(e, 3);
+    out_->Append('\n');
   }
 
+  OutputBuffer *const out_;
+
 private:
+  // Switch to the requested feedrate, unless extruding with
+  // "extrusion_multiplier" at that speed would need the filament to be
+  // faster than the hotend can melt it; then slow down just enough.
+  // Returns true if slowed down.
+  bool UseFeedrate(double extrusion_multiplier) {
+    double feedrate = requested_feedrate_;
+    bool limited = false;
+    const double e_per_mm = filament_extrusion_factor_ * extrusion_multiplier;
+    if (max_e_feedrate_ > 0 && feedrate * e_per_mm > max_e_feedrate_) {
+      feedrate = max_e_feedrate_ / e_per_mm;
+      limited = true;
+    }
+    if (feedrate != current_feedrate_) {
+      EmitFeedrate(feedrate, limited);
+    }
+    return limited;
+  }
+
+  void EmitFeedrate(double feed_mm_per_sec, bool flow_limited) {
+    out_->Append("G1 F");
+    out_->AppendFixed(feed_mm_per_sec * 60, 1);
+    out_->Append("  ; feedrate=");
+    out_->AppendFixed(feed_mm_per_sec, 1);
+    out_->Append(flow_limited ? "mm/s (flow limit)\n" : "mm/s\n");
+    current_feedrate_ = feed_mm_per_sec;
+  }
+
+  void CopyStateFrom(const GCodePrinter &other) {
+    current_feedrate_ = other.current_feedrate_;
+    requested_feedrate_ = other.requested_feedrate_;
+    temperature_ = other.temperature_;
+    last_x = other.last_x; last_y = other.last_y; last_z = other.last_z;
+    extrude_dist_ = other.extrude_dist_;
+    in_retract_ = other.in_retract_;
+  }
+
+  // "G1 X<x> Y<y> Z<z>", the common prefix of all moves.
+  void AppendXYZ(const Vector2D &pos, double z) {
+    out_->Append("G1 X");
+    out_->AppendFixed(pos.x, 3);
+    out_->Append(" Y");
+    out_->AppendFixed(pos.y, 3);
+    out_->Append(" Z");
+    out_->AppendFixed(z, 3);
+  }
+
   const double filament_extrusion_factor_;
   const double retract_amount_;
-  double current_feedrate_;
+  const double max_e_feedrate_;   // Filament mm/s the hotend can melt.
+  double current_feedrate_;     // As last sent to the printer.
+  double requested_feedrate_;   // As set with SetSpeed().
   double temperature_;
   double bed_temp_;
   double last_x, last_y, last_z;
   double extrude_dist_;
   bool in_retract_ = false;
+  int flow_limited_moves_;
+  const MotionLimits motion_limits_;
+  MotionPlanner planner_;
+};
+
+// GCode, but in a compact binary representation (see binary-gcode.h).
+// All non-movement GCode is generated by the GCodePrinter into a text
+// buffer, that is then passed on as text record.
+class BinaryGCodePrinter : public GCodePrinter {
+public:
+  // Writes to "out", which we take ownership of.
+  BinaryGCodePrinter(OutputBuffer *out, double extrusion_factor,
+                     double retract_amount, double temperature,
+                     double bed_temp, double max_e_feedrate,
+                     const MotionLimits &motion_limits)
+    : GCodePrinter(new OutputBuffer(), extrusion_factor, retract_amount,
+                   temperature, bed_temp, max_e_feedrate, motion_limits),
+      file_out_(out), writer_(file_out_) {}
+  virtual ~BinaryGCodePrinter() {
+    writer_.Finish();
+    delete file_out_;
+  }
+
+  // No "(G-Code)" preamble; the binary file has its own header.
+  virtual void Preamble(const Vector2D &machine_limit,
+                        double feed_mm_per_sec) {}
+
+  virtual void Init(const Vector2D &machine_limit,
+                    double feed_mm_per_sec) {
+    // All we have seen so far are header comments. They become metadata.
+    std::string metadata;
+    const char *const end = out_->data() + out_->size();
+    for (const char *line = out_->data(); line < end; /**/) {
+      const char *eol = std::find(line, end, '\n');
+      if (eol != end) ++eol;
+      if (eol - line >= 2 && line[0] == ';' && line[1] == ' ')
+        line += 2;
+      metadata.append(line, eol);
+      line = eol;
+    }
+    out_->Clear();
+    writer_.WriteHeader(metadata);
+    GCodePrinter::Init(machine_limit, feed_mm_per_sec);
+  }
+
+  virtual void Postamble() {
+    GCodePrinter::Postamble();
+    FlushText();
+    writer_.Finish();
+    file_out_->Flush();
+  }
+
+  // Delta encoding is a sequential process.
+  virtual Printer *CreateDetached() const { return NULL; }
+
+protected:
+  virtual void EmitZMove(double z) {
+    int64_t iz;
+    if (!RoundFixed(z, 3, &iz))
+      return GCodePrinter::EmitZMove(z);
+    FlushText();
+    writer_.AddZMove(iz);
+  }
+  virtual void EmitMove(const Vector2D &pos, double z) {
+    int64_t x, y, iz;
+    if (!RoundFixed(pos.x, 3, &x) || !RoundFixed(pos.y, 3, &y)
+        || !RoundFixed(z, 3, &iz))
+      return GCodePrinter::EmitMove(pos, z);
+    FlushText();
+    writer_.AddMove(x, y, iz);
+  }
+  virtual void EmitExtrude(const Vector2D &pos, double z, double e) {
+    int64_t x, y, iz, ie;
+    if (!RoundFixed(pos.x, 3, &x) || !RoundFixed(pos.y, 3, &y)
+        || !RoundFixed(z, 3, &iz) || !RoundFixed(e, 3, &ie))
+      return GCodePrinter::EmitExtrude(pos, z, e);
+    FlushText();
+    writer_.AddExtrude(x, y, iz, ie);
+  }
+
+  virtual void EmitArc(const Vector2D &pos, double z,
+                       const Vector2D &center_offset, bool clockwise,
+                       double e) {
+    int64_t x, y, iz, i, j, ie;
+    if (!RoundFixed(pos.x, 3, &x) || !RoundFixed(pos.y, 3, &y)
+        || !RoundFixed(z, 3, &iz) || !RoundFixed(center_offset.x, 3, &i)
+        || !RoundFixed(center_offset.y, 3, &j) || !RoundFixed(e, 3, &ie))
+      return GCodePrinter::EmitArc(pos, z, center_offset, clockwise, e);
+    FlushText();
+    writer_.AddArc(clockwise, x, y, iz, i, j, ie);
+  }
+
+private:
+  void FlushText() {
+    writer_.AddText(out_->data(), out_->size());
+    out_->Clear();
+  }
+
+  OutputBuffer *const file_out_;
+  BinaryGCodeWriter writer_;
 };
 
 class PostScriptPrinter : public Printer {
 public:
-  PostScriptPrinter(bool show_move_as_line, double line_thickness)
+  // Writes to "out", which we take ownership of.
+  PostScriptPrinter(OutputBuffer *out, bool show_move_as_line,
+                    double line_thickness)
     : show_move_as_line_(show_move_as_line), line_thickness_(line_thickness),
-      in_move_color_(false), r_(0), g_(0), b_(0) {
+      in_move_color_(false), r_(0), g_(0), b_(0), out_(out) {
   }
+  virtual ~PostScriptPrinter() { delete out_; }
   virtual void Preamble(const Vector2D &machine_limit,
                         double feed_mm_per_sec) {
     const float mm_to_point = 1 / 25.4 * 72.0;
-    printf("%%!PS-Adobe-3.0\n%%%%BoundingBox: 0 0 %.0f %.0f\n\n",
-           machine_limit.x * mm_to_point, machine_limit.y * mm_to_point);
+    out_->Printf("%%!PS-Adobe-3.0\n%%%%BoundingBox: 0 0 %.0f %.0f\n\n",
+                 machine_limit.x * mm_to_point, machine_limit.y * mm_to_point);
   }
   virtual void Init(const Vector2D &machine_limit,
                     double feed_mm_per_sec) {
-    printf("/extrude-to { lineto } def\n");
-    printf("72.0 25.4 div dup scale  %% Switch to mm\n");
-    printf("1 setlinejoin\n");
-    printf("%.2f setlinewidth %% mm\n", line_thickness_);
-    printf("0 0 moveto\n");
+    out_->Append("/extrude-to { lineto } def\n");
+    out_->Append("72.0 25.4 div dup scale  % Switch to mm\n");
+    out_->Append("1 setlinejoin\n");
+    out_->Printf("%.2f setlinewidth %% mm\n", line_thickness_);
+    out_->Append("0 0 moveto\n");
   }
 
   virtual void Postamble() {
-    printf("stroke\nshowpage\n");
+    out_->Append("stroke\nshowpage\n");
+    out_->Flush();
   }
   virtual void Comment(const char *fmt, ...) {
-    printf("%% ");
-    va_list ap; va_start(ap, fmt); vprintf(fmt, ap); va_end(ap);
+    out_->Append("% ");
+    va_list ap; va_start(ap, fmt); out_->VPrintf(fmt, ap); va_end(ap);
   }
   virtual void SetSpeed(double feed_mm_per_sec) {}
   virtual void SetTemperature(double t) {}
   virtual void ResetExtrude() {
-    printf("%% Flush lines but remember where we are.\n"
-           "currentpoint\nstroke\nmoveto\n");
+    out_->Append("% Flush lines but remember where we are.\n"
+                 "currentpoint\nstroke\nmoveto\n");
   }
   virtual void Retract() {}
   virtual void GoZPos(double z) {}
@@ -188,9 +462,11 @@ public:
         ColorSwitch(0, 0, 0, 0.9);  // blue move color
         in_move_color_ = true;
       }
-      printf("%.3f %.3f lineto\n", pos.x, pos.y);
+      AppendXY(pos);
+      out_->Append(" lineto\n");
     } else {
-      printf("%.3f %.3f moveto\n", pos.x, pos.y);
+      AppendXY(pos);
+      out_->Append(" moveto\n");
     }
   }
   virtual void ExtrudeTo(const Vector2D &pos, double /*z*/,
@@ -199,7 +475,8 @@ public:
       ColorSwitch(line_thickness_, r_, g_, b_);
       in_move_color_ = false;
     }
-    printf("%.3f %.3f extrude-to\n", pos.x, pos.y);
+    AppendXY(pos);
+    out_->Append(" extrude-to\n");
   }
   virtual void SwitchFan(bool on) {}
   virtual double GetExtrusionDistance() { return 0; }
@@ -209,30 +486,76 @@ public:
       ColorSwitch(line_thickness_, r, g, b);
     }
   }
+
+  virtual Printer *CreateDetached() const {
+    return new PostScriptPrinter(this, new OutputBuffer());
+  }
+  virtual bool SameState(const Printer &detached) const {
+    const PostScriptPrinter &other
+      = static_cast<const PostScriptPrinter&>(detached);
+    return (in_move_color_ == other.in_move_color_
+            && r_ == other.r_ && g_ == other.g_ && b_ == other.b_);
+  }
+  virtual void AppendDetached(const Printer &detached) {
+    const PostScriptPrinter &other
+      = static_cast<const PostScriptPrinter&>(detached);
+    out_->Append(other.out_->data(), other.out_->size());
+    in_move_color_ = other.in_move_color_;
+    r_ = other.r_; g_ = other.g_; b_ = other.b_;
+  }
+
 private:
+  // Create a copy of "other", but writing to "out", which we take ownership of.
+  PostScriptPrinter(const PostScriptPrinter *other, OutputBuffer *out)
+    : show_move_as_line_(other->show_move_as_line_),
+      line_thickness_(other->line_thickness_),
+      in_move_color_(other->in_move_color_),
+      r_(other->r_), g_(other->g_), b_(other->b_), out_(out) {
+  }
+
+  void AppendXY(const Vector2D &pos) {
+    out_->AppendFixed(pos.x, 3);
+    out_->Append(' ');
+    out_->AppendFixed(pos.y, 3);
+  }
+
   void ColorSwitch(float line_width, float r, float g, float b) {
-    printf("currentpoint\nstroke\n");   // finish last path; remember pos
-    printf("%.1f setlinewidth %% mm\n", line_width);
-    printf("%.1f %.1f %.1f setrgbcolor\n", r, g, b);
-    printf("moveto\n");   // set current point to remembered pos.
+    out_->Append("currentpoint\nstroke\n");   // finish last path; remember pos
+    out_->Printf("%.1f setlinewidth %% mm\n", line_width);
+    out_->Printf("%.1f %.1f %.1f setrgbcolor\n", r, g, b);
+    out_->Append("moveto\n");   // set current point to remembered pos.
   }
 
   const bool show_move_as_line_;
   const float line_thickness_;
   bool in_move_color_;
   float r_, g_, b_;   // color.
+  OutputBuffer *const out_;
 };
 
 }  // end anonymous namespace.
 
 // Public interface
-Printer *CreateGCodePrinter(double extrusion_mm_to_e_axis_factor,
+Printer *CreateGCodePrinter(OutputBuffer *out,
+                            double extrusion_mm_to_e_axis_factor,
                             double retract_amount,
-                            double temp, double bed_temp) {
-  return new GCodePrinter(extrusion_mm_to_e_axis_factor, retract_amount,
-                          temp, bed_temp);
+                            double temp, double bed_temp,
+                            double max_e_feedrate,
+                            const MotionLimits &motion_limits) {
+  return new GCodePrinter(out, extrusion_mm_to_e_axis_factor, retract_amount,
+                          temp, bed_temp, max_e_feedrate, motion_limits);
+}
+Printer *CreateBinaryGCodePrinter(OutputBuffer *out,
+                                  double extrusion_mm_to_e_axis_factor,
+                                  double retract_amount,
+                                  double temp, double bed_temp,
+                                  double max_e_feedrate,
+                                  const MotionLimits &motion_limits) {
+  return new BinaryGCodePrinter(out, extrusion_mm_to_e_axis_factor,
+                                retract_amount, temp, bed_temp,
+                                max_e_feedrate, motion_limits);
 }
-Printer *CreatePostscriptPrinter(bool show_move_as_line,
+Printer *CreatePostscriptPrinter(OutputBuffer *out, bool show_move_as_line,
                                  double line_thickness_mm) {
-  return new PostScriptPrinter(show_move_as_line, line_thickness_mm);
+  return new PostScriptPrinter(out, show_move_as_line, line_thickness_mm);
 }
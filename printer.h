@@ -21,6 +21,8 @@
 // output.
 class Printer {
 public:
+  virtual ~Printer() {}
+
   // Preamble: what to do to start the file.
   virtual void Preamble(const Vector2D &machine_limit,
                         double feed_mm_per_sec) = 0;
@@ -45,22 +47,83 @@ public:
   // Extrude/"Line" to absolute position.
   virtual void ExtrudeTo(const Vector2D &pos, double z,
                          double extrusion_multiplier) = 0;
+  // Extrude along "count" points given in separate x, y, z arrays.
+  // "segment_len" contains the distance of each point to the previous one;
+  // the first relative to the current position.
+  virtual void ExtrudePath(const double *x, const double *y, const double *z,
+                           const double *segment_len, int count,
+                           double extrusion_multiplier) {
+    for (int i = 0; i < count; ++i) {
+      ExtrudeTo(Vector2D(x[i], y[i]), z[i], extrusion_multiplier);
+    }
+  }
+
+  // Extrude along "count" points as in ExtrudePath(), that all lie on a
+  // circular arc around "center" starting from the current position.
+  // Printers that know about arcs can output them as one move.
+  virtual void ExtrudeArc(const double *x, const double *y, const double *z,
+                          const double *segment_len, int count,
+                          const Vector2D &center, bool clockwise,
+                          double extrusion_multiplier) {
+    ExtrudePath(x, y, z, segment_len, count, extrusion_multiplier);
+  }
+
   virtual void SwitchFan(bool on) = 0;
   virtual double GetExtrusionDistance() = 0;
+  // Estimated time in seconds for all moves so far, or 0 if this printer
+  // has no notion of time.
+  virtual double GetPrintTime() { return 0; }
+  // Number of extrusion moves slowed down to stay within the flow the
+  // hotend can handle.
+  virtual int GetFlowLimitedMoves() { return 0; }
   // Nice-to-have. Mostly for visualization reasons, doesn't change
   virtual void SetColor(float r, float g, float b) {}
+
+  // -- Support for generating independent parts (screws) in parallel.
+
+  // Create a printer of the same kind, settings and current state, that
+  // keeps its output in memory. Returns NULL if not supported.
+  virtual Printer *CreateDetached() const { return NULL; }
+
+  // Returns true, if this printer would create the same output as the
+  // printer "detached" (created by our CreateDetached()) for a sequence of
+  // calls that starts with MoveTo() and ResetExtrude(), as each screw does.
+  virtual bool SameState(const Printer &detached) const { return false; }
+
+  // Append output of a printer created by our CreateDetached() and continue
+  // in the state that printer is in.
+  virtual void AppendDetached(const Printer &detached) {}
 };
 
-// Create a printer that outputs GCode to stdout.
+class OutputBuffer;
+struct MotionLimits;
+
+// Create a printer that outputs GCode to "out" (ownership is taken).
 // "extrusion_mm_to_e_axis_factor" translates mm extruded length to E-axis
-// output.
-Printer *CreateGCodePrinter(double extrusion_mm_to_e_axis_factor,
+// output. If "max_e_feedrate" is > 0, extrusion is slowed down so that the
+// E-axis does not move faster than that (mm/s of filament): the volumetric
+// flow limit of the hotend.
+// The print time is estimated for a printer with "motion_limits".
+Printer *CreateGCodePrinter(OutputBuffer *out,
+                            double extrusion_mm_to_e_axis_factor,
                             double retract,
-                            double temperature, double bed_temp);
+                            double temperature, double bed_temp,
+                            double max_e_feedrate,
+                            const MotionLimits &motion_limits);
+
+// Create a printer that outputs binary GCode to "out" (ownership is taken).
+// Same GCode as CreateGCodePrinter(), but in a compressed block format
+// described in binary-gcode.h
+Printer *CreateBinaryGCodePrinter(OutputBuffer *out,
+                                  double extrusion_mm_to_e_axis_factor,
+                                  double retract,
+                                  double temperature, double bed_temp,
+                                  double max_e_feedrate,
+                                  const MotionLimits &motion_limits);
 
-// Create printer that outputs PostScript to stdout.
+// Create printer that outputs PostScript to "out" (ownership is taken).
 // If "show_move_as_line" is true, visualizes moves as blue lines.
-Printer *CreatePostscriptPrinter(bool show_move_as_line,
+Printer *CreatePostscriptPrinter(OutputBuffer *out, bool show_move_as_line,
                                  double line_thickness_mm);
 
 #undef PRINTF_FMT_CHECK
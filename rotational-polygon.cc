@@ -7,6 +7,8 @@
 #include <stdio.h>
 #include <assert.h>
 
+#include <algorithm>
+
 #include "multi-shell-extrude.h"
 
 namespace {
@@ -42,42 +44,124 @@ namespace {
       return a + (b - a) * fraction;
     }
 
+    // Number of values; the function is linear between them.
+    int size() const { return values_.size(); }
+
   private:
     std::vector<double> values_;
   };
 }  // namespace
 
-static int quantize_up(int x, int q) {
-  return q * ((x + q - 1) / q);
-}
-
 static double AngleTwist(double twist, double r, double max_r) {
   return twist * r / max_r;
 }
 
+namespace {
+// The outline described by the polar function, with the radius and twist
+// applied.
+class RotationalCurve {
+public:
+  RotationalCurve(PolarFunction *fun, double inner_radius, double thread_depth,
+                  double twist)
+    : fun_(fun), inner_radius_(inner_radius), thread_depth_(thread_depth),
+      twist_(twist), max_r_(inner_radius + thread_depth) {}
+
+  // Point at "phi", which is the fraction of a full turn (0..1 inclusive).
+  Vector2D At(double phi) const {
+    const double value = fun_->value(phi < 1 ? phi : phi - 1);
+    const double r = inner_radius_ + thread_depth_ * value;
+    const double a = (phi + AngleTwist(twist_, r, max_r_)) * 2 * M_PI;
+    return Vector2D(r * cos(a), r * sin(a));
+  }
+
+private:
+  PolarFunction *const fun_;
+  const double inner_radius_;
+  const double thread_depth_;
+  const double twist_;
+  const double max_r_;
+};
+}  // namespace
+
+// Distance of "p" from the line through "a" and "b".
+static double LineDistance(const Vector2D &p,
+                           const Vector2D &a, const Vector2D &b) {
+  const Vector2D d = b - a;
+  const double len = distance(d.x, d.y, 0);
+  if (len == 0) return distance(p.x - a.x, p.y - a.y, 0);
+  return fabs(d.x * (p.y - a.y) - d.y * (p.x - a.x)) / len;
+}
+
+// Returns true, if the segment from "phi_a" to "phi_b" does not deviate more
+// than "max_error" from the curve. We look at the actual deviation in the
+// middle and at the quarters.
+static bool SegmentFits(const RotationalCurve &curve,
+                        double phi_a, double phi_b, double max_error) {
+  const Vector2D a = curve.At(phi_a);
+  const Vector2D b = curve.At(phi_b);
+  for (int q = 1; q <= 3; ++q) {
+    const Vector2D p = curve.At(phi_a + (phi_b - phi_a) * q / 4);
+    if (LineDistance(p, a, b) > max_error)
+      return false;
+  }
+  return true;
+}
+
+// If all "n" equal segments between "phi_a" and "phi_b" stay within
+// "max_error" of the curve.
+static bool SegmentsFit(const RotationalCurve &curve,
+                        double phi_a, double phi_b, int n, double max_error) {
+  for (int i = 0; i < n; ++i) {
+    if (!SegmentFits(curve, phi_a + (phi_b - phi_a) * i / n,
+                     phi_a + (phi_b - phi_a) * (i + 1) / n, max_error))
+      return false;
+  }
+  return true;
+}
+
+// Small number of equal segments between "phi_a" and "phi_b" that stay
+// within "max_error" of the curve. Doubling, then bisecting needs only
+// O(n log n) SegmentFits() calls, as opposed to O(n²) trying n = 1, 2, ...
+static int SegmentsNeeded(const RotationalCurve &curve,
+                          double phi_a, double phi_b, double max_error) {
+  static const int kMaxSegments = 10000;
+  int fits = 1;
+  while (!SegmentsFit(curve, phi_a, phi_b, fits, max_error)) {
+    if (fits >= kMaxSegments)
+      return kMaxSegments;
+    fits = std::min(2 * fits, kMaxSegments);
+  }
+  int too_few = fits / 2;   // Known not to fit, or 0.
+  while (fits - too_few > 1) {
+    const int n = (too_few + fits) / 2;
+    if (SegmentsFit(curve, phi_a, phi_b, n, max_error)) {
+      fits = n;
+    } else {
+      too_few = n;
+    }
+  }
+  return fits;
+}
+
 Polygon RotationalPolygon(const char *fun_init, double inner_radius,
-			  double thread_depth, double twist) {
-  Polygon result;
-  const double max_r = inner_radius + thread_depth;
+                          double thread_depth, double twist,
+                          double max_error) {
   PolarFunction fun(fun_init);
-  const double max_error = 0.01;  // millimeter; maximum error to tolerate
-  // Maximum lenght of one edge of our cylinder, that should not differ more
-  // than max_error in the middle. Half a segment is a nice perpendicular
-  // triangle
-  const double half_segment = sqrt((max_r*max_r)
-                                   - (max_r - max_error)*(max_r - max_error));
-  int faces = ceil((2 * M_PI * max_r) / (2 * half_segment));
-  faces = quantize_up(faces, strlen(fun_init));   // same sampling per letter.
-  if (fabs(twist) > 0.05) {
-    faces *= 4;  // when twisting, we do more. TODO: calculate better.
-  }
-  for (int f = 0; f < faces; ++f) {
-    const double angle = 1.0 * f / faces;
-    double pol_value = fun.value(angle);
-    const double r = inner_radius + thread_depth * pol_value;
-    const double x = r * cos((angle + AngleTwist(twist, r, max_r)) * 2 * M_PI);
-    const double y = r * sin((angle + AngleTwist(twist, r, max_r)) * 2 * M_PI);
-    result.push_back(Vector2D(x, y));
+  const RotationalCurve curve(&fun, inner_radius, thread_depth, twist);
+  // The polar function is linear between its values, but has kinks at each
+  // of them. So they are always vertices. In between, we use as few vertices
+  // as needed for the local curvature: flat flanks need fewer vertices than
+  // thread transitions.
+  const int values = fun.size();
+  Polygon result;
+  for (int i = 0; i < values; ++i) {
+    const double phi_a = 1.0 * i / values;
+    const double phi_b = 1.0 * (i + 1) / values;
+    const int segments = SegmentsNeeded(curve, phi_a, phi_b, max_error);
+    for (int s = 0; s < segments; ++s) {
+      const double phi = phi_a + (phi_b - phi_a) * s / segments;
+      result.push_back(ToFixed(curve.At(phi)));
+    }
   }
   return result;
 }
@@ -5,5 +5,6 @@ pkgs.mkShell {
       tio
       openscad-unstable
       prusa-slicer
+      zlib
     ];
 }
@@ -0,0 +1,353 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "stats.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#  include <linux/perf_event.h>
+#  include <sys/syscall.h>
+#endif
+
+#include "printer.h"
+
+namespace {
+const char *const kPhaseNames[Stats::kPhaseCount] = {
+  "polygon", "offset", "layout", "bottom_plate", "extrusion", "output"
+};
+
+const char *const kCounterNames[Stats::kCounterCount] = {
+  "cycles", "instructions", "cache_misses"
+};
+
+int64_t NanoSeconds(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Hardware counters of the current thread, opened on first use. Counters
+// count for this thread only, so phases in different threads don't mix.
+// Only available on Linux.
+class ThreadCounters {
+public:
+  ThreadCounters() : error_(0) {
+#ifdef __linux__
+    static const uint64_t kConfig[Stats::kCounterCount] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES
+    };
+    for (int i = 0; i < Stats::kCounterCount; ++i) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = kConfig[i];
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fd_[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      if (fd_[i] < 0 && error_ == 0) error_ = errno;
+    }
+#else
+    for (int &fd : fd_) fd = -1;
+    error_ = ENOSYS;
+#endif
+  }
+  ~ThreadCounters() {
+    for (int fd : fd_) {
+      if (fd >= 0) close(fd);
+    }
+  }
+
+  // Returns 0 on success, otherwise errno why counters are not available.
+  int error() const { return error_; }
+
+  void Read(uint64_t *values) const {
+    for (int i = 0; i < Stats::kCounterCount; ++i) {
+      values[i] = 0;
+      if (fd_[i] >= 0 && read(fd_[i], &values[i], sizeof(values[i]))
+          != sizeof(values[i])) {
+        values[i] = 0;
+      }
+    }
+  }
+
+private:
+  int fd_[Stats::kCounterCount];
+  int error_;
+};
+
+ThreadCounters *GetThreadCounters() {
+  static thread_local ThreadCounters counters;
+  return &counters;
+}
+
+// Counts the calls to a printer and passes them on.
+class CountingPrinter : public Printer {
+public:
+  enum Call {
+    kPreamble, kInit, kPostamble, kComment, kSetTemperature, kSetSpeed,
+    kResetExtrude, kRetract, kGoZPos, kMoveTo, kExtrudeTo, kExtrudePath,
+    kExtrudeArc, kSwitchFan, kSetColor, kCallCount
+  };
+
+  // If "stats" is NULL, this is a detached printer, that doesn't report
+  // its counts but leaves it to the printer it is appended to.
+  CountingPrinter(Printer *delegate, Stats *stats)
+    : delegate_(delegate), stats_(stats), moves_(0) {
+    memset(calls_, 0, sizeof(calls_));
+  }
+
+  virtual ~CountingPrinter() {
+    static const char *const kCallNames[kCallCount] = {
+      "Preamble", "Init", "Postamble", "Comment", "SetTemperature",
+      "SetSpeed", "ResetExtrude", "Retract", "GoZPos", "MoveTo", "ExtrudeTo",
+      "ExtrudePath", "ExtrudeArc", "SwitchFan", "SetColor"
+    };
+    if (stats_) {
+      for (int i = 0; i < kCallCount; ++i) {
+        stats_->Add("printer_calls", kCallNames[i], calls_[i]);
+      }
+      stats_->Add("counts", "moves", moves_);
+    }
+    delete delegate_;
+  }
+
+  virtual void Preamble(const Vector2D &machine_limit,
+                        double feed_mm_per_sec) {
+    ++calls_[kPreamble];
+    delegate_->Preamble(machine_limit, feed_mm_per_sec);
+  }
+  virtual void Init(const Vector2D &machine_limit, double feed_mm_per_sec) {
+    ++calls_[kInit];
+    delegate_->Init(machine_limit, feed_mm_per_sec);
+  }
+  virtual void Postamble() {
+    ++calls_[kPostamble];
+    delegate_->Postamble();
+  }
+  virtual void Comment(const char *fmt, ...) {
+    ++calls_[kComment];
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    const int len = vsnprintf(buffer, sizeof(buffer), fmt, ap);
+    va_end(ap);
+    if (len < (int)sizeof(buffer)) {
+      delegate_->Comment("%s", buffer);
+      return;
+    }
+    std::string text(len, '\0');   // Rare: long command lines.
+    va_start(ap, fmt);
+    vsnprintf(&text[0], len + 1, fmt, ap);
+    va_end(ap);
+    delegate_->Comment("%s", text.c_str());
+  }
+  virtual void SetTemperature(double temperature) {
+    ++calls_[kSetTemperature];
+    delegate_->SetTemperature(temperature);
+  }
+  virtual void SetSpeed(double feed_mm_per_sec) {
+    ++calls_[kSetSpeed];
+    delegate_->SetSpeed(feed_mm_per_sec);
+  }
+  virtual void ResetExtrude() {
+    ++calls_[kResetExtrude];
+    delegate_->ResetExtrude();
+  }
+  virtual void Retract() {
+    ++calls_[kRetract];
+    delegate_->Retract();
+  }
+  virtual void GoZPos(double z) {
+    ++calls_[kGoZPos];
+    ++moves_;
+    delegate_->GoZPos(z);
+  }
+  virtual void MoveTo(const Vector2D &pos, double z) {
+    ++calls_[kMoveTo];
+    ++moves_;
+    delegate_->MoveTo(pos, z);
+  }
+  virtual void ExtrudeTo(const Vector2D &pos, double z,
+                         double extrusion_multiplier) {
+    ++calls_[kExtrudeTo];
+    ++moves_;
+    delegate_->ExtrudeTo(pos, z, extrusion_multiplier);
+  }
+  virtual void ExtrudePath(const double *x, const double *y, const double *z,
+                           const double *segment_len, int count,
+                           double extrusion_multiplier) {
+    ++calls_[kExtrudePath];
+    moves_ += count;
+    delegate_->ExtrudePath(x, y, z, segment_len, count, extrusion_multiplier);
+  }
+  virtual void ExtrudeArc(const double *x, const double *y, const double *z,
+                          const double *segment_len, int count,
+                          const Vector2D &center, bool clockwise,
+                          double extrusion_multiplier) {
+    ++calls_[kExtrudeArc];
+    moves_ += count;
+    delegate_->ExtrudeArc(x, y, z, segment_len, count, center, clockwise,
+                          extrusion_multiplier);
+  }
+  virtual void SwitchFan(bool on) {
+    ++calls_[kSwitchFan];
+    delegate_->SwitchFan(on);
+  }
+  virtual double GetExtrusionDistance() {
+    return delegate_->GetExtrusionDistance();
+  }
+  virtual double GetPrintTime() { return delegate_->GetPrintTime(); }
+  virtual int GetFlowLimitedMoves() {
+    return delegate_->GetFlowLimitedMoves();
+  }
+  virtual void SetColor(float r, float g, float b) {
+    ++calls_[kSetColor];
+    delegate_->SetColor(r, g, b);
+  }
+
+  virtual Printer *CreateDetached() const {
+    Printer *detached = delegate_->CreateDetached();
+    return detached ? new CountingPrinter(detached, NULL) : NULL;
+  }
+  virtual bool SameState(const Printer &detached) const {
+    return delegate_->SameState(
+      *static_cast<const CountingPrinter&>(detached).delegate_);
+  }
+  virtual void AppendDetached(const Printer &detached) {
+    const CountingPrinter &other
+      = static_cast<const CountingPrinter&>(detached);
+    delegate_->AppendDetached(*other.delegate_);
+    for (int i = 0; i < kCallCount; ++i) {
+      calls_[i] += other.calls_[i];
+    }
+    moves_ += other.moves_;
+  }
+
+private:
+  Printer *const delegate_;
+  Stats *const stats_;
+  int64_t calls_[kCallCount];
+  int64_t moves_;
+};
+}  // namespace
+
+Stats::Stats(bool hardware_counters)
+  : start_ns_(NanoSeconds(CLOCK_MONOTONIC)),
+    hardware_counters_(hardware_counters) {
+  for (PhaseTotal &phase : phases_) {
+    phase.calls = 0;
+    phase.wall_ns = 0;
+    phase.cpu_ns = 0;
+    for (std::atomic<uint64_t> &c : phase.counter) c = 0;
+  }
+  if (hardware_counters_ && GetThreadCounters()->error() != 0) {
+    hardware_error_ = std::string("unavailable: ")
+      + strerror(GetThreadCounters()->error());
+  }
+}
+
+void Stats::StartPhase(PhaseStart *start) {
+  start->wall_ns = NanoSeconds(CLOCK_MONOTONIC);
+  start->cpu_ns = NanoSeconds(CLOCK_THREAD_CPUTIME_ID);
+  if (hardware_counters_) GetThreadCounters()->Read(start->counter);
+}
+
+void Stats::EndPhase(Phase phase, const PhaseStart &start) {
+  PhaseTotal &total = phases_[phase];
+  if (hardware_counters_) {
+    uint64_t counter[kCounterCount];
+    GetThreadCounters()->Read(counter);
+    for (int i = 0; i < kCounterCount; ++i) {
+      total.counter[i] += counter[i] - start.counter[i];
+    }
+  }
+  total.cpu_ns += NanoSeconds(CLOCK_THREAD_CPUTIME_ID) - start.cpu_ns;
+  total.wall_ns += NanoSeconds(CLOCK_MONOTONIC) - start.wall_ns;
+  ++total.calls;
+}
+
+void Stats::Add(const char *group, const char *name, int64_t value) {
+  std::lock_guard<std::mutex> l(mutex_);
+  counters_[group][name] += value;
+}
+
+std::string JsonString(const std::string &s) {
+  std::string result = "\"";
+  for (const char c : s) {
+    if (c == '"' || c == '\\') {
+      result.push_back('\\');
+      result.push_back(c);
+    } else if ((unsigned char)c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      result.append(escaped);
+    } else {
+      result.push_back(c);
+    }
+  }
+  result.push_back('"');
+  return result;
+}
+
+bool Stats::WriteJson(const std::string &filename) const {
+  FILE *out = fopen(filename.c_str(), "w");
+  if (out == NULL) return false;
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  const double cpu = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+    + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+  fprintf(out, "{\n  \"wall_seconds\": %.6f,\n  \"cpu_seconds\": %.6f,\n"
+          "  \"peak_rss_kb\": %ld,\n",
+          (NanoSeconds(CLOCK_MONOTONIC) - start_ns_) / 1e9, cpu,
+          usage.ru_maxrss);
+  if (hardware_counters_) {
+    const std::string status = hardware_error_.empty() ? "ok" : hardware_error_;
+    fprintf(out, "  \"hardware_counters\": %s,\n", JsonString(status).c_str());
+  }
+
+  // Wall and CPU time of the thread(s) running each phase.
+  fprintf(out, "  \"phases\": {");
+  for (int p = 0; p < kPhaseCount; ++p) {
+    const PhaseTotal &phase = phases_[p];
+    fprintf(out, "%s\n    \"%s\": { \"calls\": %lld, \"wall_seconds\": %.6f, "
+            "\"cpu_seconds\": %.6f", p > 0 ? "," : "", kPhaseNames[p],
+            (long long)phase.calls, phase.wall_ns / 1e9, phase.cpu_ns / 1e9);
+    if (hardware_counters_ && hardware_error_.empty()) {
+      for (int i = 0; i < kCounterCount; ++i) {
+        fprintf(out, ", \"%s\": %llu", kCounterNames[i],
+                (unsigned long long)phase.counter[i]);
+      }
+    }
+    fprintf(out, " }");
+  }
+  fprintf(out, "\n  }");
+
+  std::lock_guard<std::mutex> l(mutex_);
+  for (const auto &group : counters_) {
+    fprintf(out, ",\n  %s: {", JsonString(group.first).c_str());
+    bool first = true;
+    for (const auto &counter : group.second) {
+      fprintf(out, "%s\n    %s: %lld", first ? "" : ",",
+              JsonString(counter.first).c_str(), (long long)counter.second);
+      first = false;
+    }
+    fprintf(out, "\n  }");
+  }
+  fprintf(out, "\n}\n");
+  return fclose(out) == 0;
+}
+
+Printer *CreateCountingPrinter(Printer *printer, Stats *stats) {
+  return new CountingPrinter(printer, stats);
+}
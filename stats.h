@@ -0,0 +1,100 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_STATS_H_
+#define SHELL_EXTRUDE_STATS_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+
+class Printer;
+
+// Where the time goes while creating a print, for --stats: time spent in
+// each phase, and counters of what has been done. Phases and counters can be
+// added to from multiple threads.
+class Stats {
+public:
+  // Phases don't nest: offsets done while creating the bottom plate or the
+  // extrusion count to these.
+  enum Phase {
+    kPolygon,       // Loading the polygon or RotationalPolygon()
+    kOffset,        // PolygonOffset() of the shells and brim.
+    kLayout,        // Placing screws on the bed.
+    kBottomPlate,   // CreateBottomPlate() for brim and vessel.
+    kExtrusion,     // CreateExtrusion()
+    kOutput,        // Opening, preamble, appending and writing the output.
+    kPhaseCount
+  };
+
+  // Hardware counters per phase, if "hardware_counters" and available.
+  enum Counter { kCycles, kInstructions, kCacheMisses, kCounterCount };
+
+  // Start of a phase, to be given to EndPhase().
+  struct PhaseStart {
+    int64_t wall_ns;
+    int64_t cpu_ns;
+    uint64_t counter[kCounterCount];
+  };
+
+  explicit Stats(bool hardware_counters);
+
+  void StartPhase(PhaseStart *start);
+  void EndPhase(Phase phase, const PhaseStart &start);
+
+  // Add "value" to the counter "name" in "group".
+  void Add(const char *group, const char *name, int64_t value);
+
+  // Write report as JSON. Returns false if the file can't be written.
+  bool WriteJson(const std::string &filename) const;
+
+private:
+  struct PhaseTotal {
+    std::atomic<int64_t> calls;
+    std::atomic<int64_t> wall_ns;
+    std::atomic<int64_t> cpu_ns;
+    std::atomic<uint64_t> counter[kCounterCount];
+  };
+
+  const int64_t start_ns_;
+  const bool hardware_counters_;
+  std::string hardware_error_;   // Why hardware counters are not available.
+  PhaseTotal phases_[kPhaseCount];
+
+  mutable std::mutex mutex_;
+  std::map<std::string, std::map<std::string, int64_t> > counters_;
+};
+
+// Adds the time of its scope to "phase" of "stats". Does nothing if "stats"
+// is NULL, so can be left in when --stats is not used.
+class ScopedPhase {
+public:
+  ScopedPhase(Stats *stats, Stats::Phase phase)
+    : stats_(stats), phase_(phase) {
+    if (stats_) stats_->StartPhase(&start_);
+  }
+  ~ScopedPhase() {
+    if (stats_) stats_->EndPhase(phase_, start_);
+  }
+
+private:
+  Stats *const stats_;
+  const Stats::Phase phase_;
+  Stats::PhaseStart start_;
+};
+
+// "s" as quoted JSON string, with quotes, backslashes and control characters
+// escaped.
+std::string JsonString(const std::string &s);
+
+// Create a printer that counts the calls of each kind and the moves, then
+// passes them on to "printer" (ownership is taken). Counts are added to
+// "stats" when deleted; the counts of detached printers with the output they
+// are appended with.
+Printer *CreateCountingPrinter(Printer *printer, Stats *stats);
+
+#endif  // SHELL_EXTRUDE_STATS_H_
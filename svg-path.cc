@@ -0,0 +1,399 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "svg-path.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+// Curves are split at most this deep; 2^16 segments are plenty.
+static const int kMaxSubdivision = 16;
+
+// Distance of "p" from the line segment "a" to "b".
+static double SegmentDistance(const Vector2D &p,
+                              const Vector2D &a, const Vector2D &b) {
+  const double dx = b.x - a.x, dy = b.y - a.y;
+  const double len2 = dx * dx + dy * dy;
+  double t = 0;
+  if (len2 > 0) {
+    t = ((p.x - a.x) * dx + (p.y - a.y) * dy) / len2;
+    t = std::max(0.0, std::min(1.0, t));
+  }
+  return distance(p.x - (a.x + t * dx), p.y - (a.y + t * dy), 0);
+}
+
+static Vector2D Lerp(const Vector2D &a, const Vector2D &b, double t) {
+  return Vector2D(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t);
+}
+
+// Append the cubic Bezier curve from "p0" with control points "p1", "p2" to
+// "p3" as line segments to "out" (without p0). A point of the curve is a
+// weighted sum of the control points, with at most 3/4 weight for the inner
+// ones; so if these are within 4/3 tolerance of the chord, so is the curve.
+// Otherwise, split the curve in the middle.
+static void FlattenCubic(const Vector2D &p0, const Vector2D &p1,
+                         const Vector2D &p2, const Vector2D &p3,
+                         double tolerance, int depth,
+                         std::vector<Vector2D> *out) {
+  if (depth >= kMaxSubdivision
+      || 0.75 * std::max(SegmentDistance(p1, p0, p3),
+                         SegmentDistance(p2, p0, p3)) <= tolerance) {
+    out->push_back(p3);
+    return;
+  }
+  // de Casteljau
+  const Vector2D p01 = Lerp(p0, p1, 0.5), p12 = Lerp(p1, p2, 0.5);
+  const Vector2D p23 = Lerp(p2, p3, 0.5);
+  const Vector2D p012 = Lerp(p01, p12, 0.5), p123 = Lerp(p12, p23, 0.5);
+  const Vector2D middle = Lerp(p012, p123, 0.5);
+  FlattenCubic(p0, p01, p012, middle, tolerance, depth + 1, out);
+  FlattenCubic(middle, p123, p23, p3, tolerance, depth + 1, out);
+}
+
+// Quadratic Bezier curves are cubic ones with control points 2/3 of the
+// way to the quadratic control point.
+static void FlattenQuadratic(const Vector2D &p0, const Vector2D &p1,
+                             const Vector2D &p2, double tolerance,
+                             std::vector<Vector2D> *out) {
+  FlattenCubic(p0, Lerp(p0, p1, 2.0 / 3), Lerp(p2, p1, 2.0 / 3), p2,
+               tolerance, 0, out);
+}
+
+// Signed angle from vector u to vector v.
+static double Angle(double ux, double uy, double vx, double vy) {
+  return atan2(ux * vy - uy * vx, ux * vx + uy * vy);
+}
+
+// Append the elliptical arc from "from" to "to" as line segments to "out".
+// Conversion from the SVG endpoint parametrization to center and angles as
+// in the SVG specification, appendix F.6.5.
+static void FlattenArc(const Vector2D &from, double rx, double ry,
+                       double x_axis_rotation, bool large_arc, bool sweep,
+                       const Vector2D &to, double tolerance,
+                       std::vector<Vector2D> *out) {
+  if (from.x == to.x && from.y == to.y)
+    return;
+  rx = fabs(rx);
+  ry = fabs(ry);
+  if (rx == 0 || ry == 0) {
+    out->push_back(to);
+    return;
+  }
+  const double phi = x_axis_rotation * M_PI / 180;
+  const double cos_phi = cos(phi), sin_phi = sin(phi);
+  const double dx = (from.x - to.x) / 2, dy = (from.y - to.y) / 2;
+  const double x1 = cos_phi * dx + sin_phi * dy;
+  const double y1 = -sin_phi * dx + cos_phi * dy;
+  // Radii too small to reach the end point are scaled up.
+  const double lambda = (x1 * x1) / (rx * rx) + (y1 * y1) / (ry * ry);
+  if (lambda > 1) {
+    rx *= sqrt(lambda);
+    ry *= sqrt(lambda);
+  }
+  const double num = rx * rx * ry * ry - rx * rx * y1 * y1 - ry * ry * x1 * x1;
+  const double den = rx * rx * y1 * y1 + ry * ry * x1 * x1;
+  const double coef = ((large_arc == sweep) ? -1 : 1)
+    * sqrt(std::max(0.0, num / den));
+  const double cx1 = coef * rx * y1 / ry;
+  const double cy1 = -coef * ry * x1 / rx;
+  const double cx = cos_phi * cx1 - sin_phi * cy1 + (from.x + to.x) / 2;
+  const double cy = sin_phi * cx1 + cos_phi * cy1 + (from.y + to.y) / 2;
+  const double start = Angle(1, 0, (x1 - cx1) / rx, (y1 - cy1) / ry);
+  double sweep_angle = Angle((x1 - cx1) / rx, (y1 - cy1) / ry,
+                             (-x1 - cx1) / rx, (-y1 - cy1) / ry);
+  if (!sweep && sweep_angle > 0) sweep_angle -= 2 * M_PI;
+  if (sweep && sweep_angle < 0) sweep_angle += 2 * M_PI;
+
+  // A chord of angle a on a circle of radius r deviates r * (1 - cos(a/2))
+  // from it; the larger radius of the ellipse bends least.
+  const double r = std::max(rx, ry);
+  const double max_angle = (tolerance < r)
+    ? 2 * acos(1 - tolerance / r) : M_PI / 2;
+  const int segments = std::max(1, (int)ceil(fabs(sweep_angle) / max_angle));
+  for (int i = 1; i < segments; ++i) {
+    const double a = start + sweep_angle * i / segments;
+    const double ex = rx * cos(a), ey = ry * sin(a);
+    out->push_back(Vector2D(cos_phi * ex - sin_phi * ey + cx,
+                            sin_phi * ex + cos_phi * ey + cy));
+  }
+  out->push_back(to);
+}
+
+namespace {
+// Reads the numbers and flags of path data.
+class PathReader {
+public:
+  explicit PathReader(const std::string &data) : data_(data), pos_(0) {}
+
+  // Skip whitespace and commas; returns false at end.
+  bool SkipSeparators() {
+    while (pos_ < data_.size() && (isspace((unsigned char)data_[pos_])
+                                   || data_[pos_] == ','))
+      ++pos_;
+    return pos_ < data_.size();
+  }
+
+  // Returns true if a number follows, which means the previous command is
+  // repeated.
+  bool AtNumber() {
+    if (!SkipSeparators()) return false;
+    const char c = data_[pos_];
+    return isdigit((unsigned char)c) || c == '-' || c == '+' || c == '.';
+  }
+
+  bool Number(double *result) {
+    if (!AtNumber()) return false;
+    // Not strtod(): "1.5.5" are two numbers in path data.
+    size_t end = pos_;
+    if (data_[end] == '-' || data_[end] == '+') ++end;
+    while (end < data_.size() && isdigit((unsigned char)data_[end])) ++end;
+    if (end < data_.size() && data_[end] == '.') {
+      ++end;
+      while (end < data_.size() && isdigit((unsigned char)data_[end])) ++end;
+    }
+    if (end < data_.size() && (data_[end] == 'e' || data_[end] == 'E')) {
+      size_t e = end + 1;
+      if (e < data_.size() && (data_[e] == '-' || data_[e] == '+')) ++e;
+      if (e < data_.size() && isdigit((unsigned char)data_[e])) {
+        end = e;
+        while (end < data_.size() && isdigit((unsigned char)data_[end])) ++end;
+      }
+    }
+    const std::string number = data_.substr(pos_, end - pos_);
+    char *parsed_end;
+    *result = strtod(number.c_str(), &parsed_end);
+    if (parsed_end == number.c_str()) return false;
+    pos_ += parsed_end - number.c_str();
+    return true;
+  }
+
+  bool Point(Vector2D *p) { return Number(&p->x) && Number(&p->y); }
+
+  // Arc flags are a single 0 or 1, possibly without separator.
+  bool Flag(bool *flag) {
+    if (!SkipSeparators()) return false;
+    if (data_[pos_] != '0' && data_[pos_] != '1') return false;
+    *flag = (data_[pos_++] == '1');
+    return true;
+  }
+
+  // Returns the next command letter, or 0 at the end.
+  char Command() {
+    if (!SkipSeparators()) return 0;
+    return isalpha((unsigned char)data_[pos_]) ? data_[pos_++] : 0;
+  }
+
+  bool AtEnd() { return !SkipSeparators(); }
+  size_t pos() const { return pos_; }
+
+private:
+  const std::string &data_;
+  size_t pos_;
+};
+}  // namespace
+
+// Signed area of the polygon, positive if counter-clockwise.
+static double SignedArea(const std::vector<Vector2D> &polygon) {
+  double area = 0;
+  for (size_t i = 0; i < polygon.size(); ++i) {
+    const Vector2D &a = polygon[i];
+    const Vector2D &b = polygon[(i + 1) % polygon.size()];
+    area += a.x * b.y - b.x * a.y;
+  }
+  return area / 2;
+}
+
+bool FindSvgPath(const char *data, size_t size, std::string *path_data) {
+  const std::string svg(data, size);
+  size_t pos = 0;
+  while ((pos = svg.find("<path", pos)) != std::string::npos) {
+    pos += 5;
+    if (pos < svg.size() && !isspace((unsigned char)svg[pos]))
+      continue;   // Some other element, such as <pathFoo>
+    const size_t end = svg.find('>', pos);
+    if (end == std::string::npos)
+      return false;   // Truncated tag.
+    // Attributes: name="value" or name='value'
+    while (pos < end) {
+      while (pos < end && isspace((unsigned char)svg[pos])) ++pos;
+      const size_t name_start = pos;
+      while (pos < end && svg[pos] != '=' && svg[pos] != '/'
+             && !isspace((unsigned char)svg[pos]))
+        ++pos;
+      const std::string name = svg.substr(name_start, pos - name_start);
+      while (pos < end && isspace((unsigned char)svg[pos])) ++pos;
+      if (pos >= end || svg[pos] != '=')
+        break;
+      ++pos;
+      while (pos < end && isspace((unsigned char)svg[pos])) ++pos;
+      if (pos >= end || (svg[pos] != '"' && svg[pos] != '\''))
+        break;
+      const size_t value_end = svg.find(svg[pos], pos + 1);
+      if (value_end == std::string::npos)
+        return false;
+      if (name == "d") {
+        *path_data = svg.substr(pos + 1, value_end - pos - 1);
+        return true;
+      }
+      if (name == "transform") {
+        fprintf(stderr, "SVG path: transform is not applied.\n");
+      }
+      pos = value_end + 1;
+    }
+  }
+  return false;
+}
+
+bool SvgPathToPolygon(const std::string &path_data, double tolerance,
+                      std::vector<Vector2D> *polygon) {
+  std::vector<std::vector<Vector2D> > subpaths;
+  PathReader reader(path_data);
+  Vector2D current;
+  Vector2D subpath_start;
+  Vector2D last_control;   // For the smooth curves S and T.
+  char previous = 0;
+  char command = 0;
+  while (!reader.AtEnd()) {
+    const char c = reader.Command();
+    if (c != 0) {
+      command = c;
+    } else if (command == 0 || command == 'z' || command == 'Z'
+               || !reader.AtNumber()) {
+      fprintf(stderr, "SVG path: unexpected '%c' at position %zu\n",
+              path_data[reader.pos()], reader.pos());
+      return false;
+    }
+    // Coordinates of lower case commands are relative to the current point.
+    const bool relative = islower((unsigned char)command);
+    const Vector2D base = relative ? current : Vector2D(0, 0);
+    const char kind = toupper((unsigned char)command);
+    Vector2D p1, p2, p;
+    bool ok = true;
+    switch (kind) {
+    case 'M':
+      ok = reader.Point(&p);
+      if (!ok) break;
+      current = subpath_start = base + p;
+      subpaths.push_back(std::vector<Vector2D>(1, current));
+      // Following coordinate pairs are lines.
+      command = relative ? 'l' : 'L';
+      break;
+    case 'L':
+    case 'H':
+    case 'V':
+      if (kind == 'L') {
+        ok = reader.Point(&p);
+        current = base + p;
+      } else if (kind == 'H') {
+        ok = reader.Number(&p.x);
+        current.x = base.x + p.x;
+      } else {
+        ok = reader.Number(&p.y);
+        current.y = base.y + p.y;
+      }
+      if (ok && !subpaths.empty()) subpaths.back().push_back(current);
+      break;
+    case 'C':
+    case 'S': {
+      if (kind == 'C') {
+        ok = reader.Point(&p1);
+        p1 = base + p1;
+      } else {
+        // First control point is the reflection of the previous one.
+        const bool after_cubic = (previous == 'C' || previous == 'S');
+        p1 = after_cubic
+          ? Vector2D(2 * current.x - last_control.x,
+                     2 * current.y - last_control.y)
+          : current;
+      }
+      ok = ok && reader.Point(&p2) && reader.Point(&p);
+      if (!ok || subpaths.empty()) break;
+      p2 = base + p2;
+      p = base + p;
+      FlattenCubic(current, p1, p2, p, tolerance, 0, &subpaths.back());
+      last_control = p2;
+      current = p;
+      break;
+    }
+    case 'Q':
+    case 'T': {
+      if (kind == 'Q') {
+        ok = reader.Point(&p1);
+        p1 = base + p1;
+      } else {
+        const bool after_quadratic = (previous == 'Q' || previous == 'T');
+        p1 = after_quadratic
+          ? Vector2D(2 * current.x - last_control.x,
+                     2 * current.y - last_control.y)
+          : current;
+      }
+      ok = ok && reader.Point(&p);
+      if (!ok || subpaths.empty()) break;
+      p = base + p;
+      FlattenQuadratic(current, p1, p, tolerance, &subpaths.back());
+      last_control = p1;
+      current = p;
+      break;
+    }
+    case 'A': {
+      double rx, ry, rotation;
+      bool large_arc, sweep;
+      ok = (reader.Number(&rx) && reader.Number(&ry)
+            && reader.Number(&rotation) && reader.Flag(&large_arc)
+            && reader.Flag(&sweep) && reader.Point(&p));
+      if (!ok || subpaths.empty()) break;
+      p = base + p;
+      FlattenArc(current, rx, ry, rotation, large_arc, sweep, p, tolerance,
+                 &subpaths.back());
+      current = p;
+      break;
+    }
+    case 'Z':
+      current = subpath_start;
+      break;
+    default:
+      fprintf(stderr, "SVG path: unknown command '%c'\n", command);
+      return false;
+    }
+    if (!ok || subpaths.empty()) {
+      fprintf(stderr, "SVG path: incomplete '%c' at position %zu\n",
+              command, reader.pos());
+      return false;
+    }
+    previous = kind;
+  }
+
+  // The largest sub-path is the outline; others might be holes or details
+  // that can't be printed as one shell.
+  size_t best = 0;
+  for (size_t i = 1; i < subpaths.size(); ++i) {
+    if (fabs(SignedArea(subpaths[i])) > fabs(SignedArea(subpaths[best])))
+      best = i;
+  }
+  if (subpaths.size() > 1) {
+    fprintf(stderr, "SVG path: using the largest of %zu sub-paths.\n",
+            subpaths.size());
+  }
+  polygon->clear();
+  if (subpaths.empty())
+    return true;
+  for (const Vector2D &p : subpaths[best]) {
+    polygon->push_back(Vector2D(p.x, -p.y));
+  }
+  // Closing back to the start is implicit in the polygon.
+  if (polygon->size() > 1 && polygon->back().x == polygon->front().x
+      && polygon->back().y == polygon->front().y) {
+    polygon->pop_back();
+  }
+  if (SignedArea(*polygon) < 0) {
+    std::reverse(polygon->begin(), polygon->end());
+  }
+  return true;
+}
@@ -0,0 +1,31 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_SVG_PATH_H_
+#define SHELL_EXTRUDE_SVG_PATH_H_
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "multi-shell-extrude.h"
+
+// Find the first <path> element in the SVG document "data" and store its
+// path data (the "d" attribute) in "path_data". Returns false if there is
+// none.
+bool FindSvgPath(const char *data, size_t size, std::string *path_data);
+
+// Create a polygon from SVG "path_data" with the commands M, L, H, V, C, S,
+// Q, T, A and Z (and their relative lower case versions). Curves are
+// flattened adaptively, so that the polygon deviates at most "tolerance" from
+// them, with as few vertices as possible.
+// If there are multiple sub-paths, the one with the largest area is used.
+// The y-axis is flipped (SVG y points down) and the polygon is oriented
+// counter-clockwise, as PolygonOffset() expects.
+// Returns false, after printing why, if the path data can't be parsed.
+bool SvgPathToPolygon(const std::string &path_data, double tolerance,
+                      std::vector<Vector2D> *polygon);
+
+#endif  // SHELL_EXTRUDE_SVG_PATH_H_
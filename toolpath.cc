@@ -0,0 +1,262 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "toolpath.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "printer.h"
+
+Toolpath::Toolpath(double max_z) : max_z_(max_z) {}
+
+void Toolpath::Append(const Toolpath &other) {
+  ops_.insert(ops_.end(), other.ops_.begin(), other.ops_.end());
+  values_.insert(values_.end(), other.values_.begin(), other.values_.end());
+  text_.append(other.text_);
+}
+
+void Toolpath::Replay(Printer *printer) const {
+  const double *v = values_.data();
+  const char *text = text_.data();
+  for (const uint8_t op : ops_) {
+    switch (op) {
+    case kPreamble:
+      printer->Preamble(Vector2D(v[0], v[1]), v[2]);
+      v += 3;
+      break;
+    case kInit:
+      printer->Init(Vector2D(v[0], v[1]), v[2]);
+      v += 3;
+      break;
+    case kPostamble:
+      printer->Postamble();
+      break;
+    case kComment:
+      printer->Comment("%s", text);
+      text += strlen(text) + 1;
+      break;
+    case kSetTemperature:
+      printer->SetTemperature(*v++);
+      break;
+    case kSetSpeed:
+      printer->SetSpeed(*v++);
+      break;
+    case kResetExtrude:
+      printer->ResetExtrude();
+      break;
+    case kRetract:
+      printer->Retract();
+      break;
+    case kGoZPos:
+      printer->GoZPos(*v++);
+      break;
+    case kMoveTo:
+      printer->MoveTo(Vector2D(v[0], v[1]), v[2]);
+      v += 3;
+      break;
+    case kExtrudeTo:
+      printer->ExtrudeTo(Vector2D(v[0], v[1]), v[2], v[3]);
+      v += 4;
+      break;
+    case kExtrudePath: {
+      // count, extrusion multiplier, then x, y, z and segment_len arrays.
+      const int count = v[0];
+      const double *x = v + 2;
+      printer->ExtrudePath(x, x + count, x + 2 * count, x + 3 * count,
+                           count, v[1]);
+      v += 2 + 4 * count;
+      break;
+    }
+    case kExtrudeArc: {
+      // count, extrusion multiplier, center x, y, clockwise, then arrays.
+      const int count = v[0];
+      const double *x = v + 5;
+      printer->ExtrudeArc(x, x + count, x + 2 * count, x + 3 * count,
+                          count, Vector2D(v[2], v[3]), v[4] != 0, v[1]);
+      v += 5 + 4 * count;
+      break;
+    }
+    case kSwitchFan:
+      printer->SwitchFan(*v++ != 0);
+      break;
+    case kSetColor:
+      printer->SetColor(v[0], v[1], v[2]);
+      v += 3;
+      break;
+    }
+  }
+}
+
+// Records the calls to a toolpath and passes them on.
+class ToolpathRecorder : public Printer {
+public:
+  // If "owned" is true, "toolpath" is deleted with this printer.
+  ToolpathRecorder(Printer *delegate, Toolpath *toolpath, bool owned)
+    : delegate_(delegate), toolpath_(toolpath), owned_(owned) {}
+  virtual ~ToolpathRecorder() {
+    delete delegate_;
+    if (owned_) delete toolpath_;
+  }
+
+  virtual void Preamble(const Vector2D &machine_limit,
+                        double feed_mm_per_sec) {
+    toolpath_->Add(Toolpath::kPreamble, machine_limit.x, machine_limit.y,
+                   feed_mm_per_sec);
+    if (delegate_) delegate_->Preamble(machine_limit, feed_mm_per_sec);
+  }
+  virtual void Init(const Vector2D &machine_limit, double feed_mm_per_sec) {
+    toolpath_->Add(Toolpath::kInit, machine_limit.x, machine_limit.y,
+                   feed_mm_per_sec);
+    if (delegate_) delegate_->Init(machine_limit, feed_mm_per_sec);
+  }
+  virtual void Postamble() {
+    toolpath_->Add(Toolpath::kPostamble);
+    if (delegate_) delegate_->Postamble();
+  }
+  virtual void Comment(const char *fmt, ...) {
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    const int len = vsnprintf(buffer, sizeof(buffer), fmt, ap);
+    va_end(ap);
+    std::string text(buffer);
+    if (len >= (int)sizeof(buffer)) {   // Rare: long command lines.
+      text.resize(len);
+      va_start(ap, fmt);
+      vsnprintf(&text[0], len + 1, fmt, ap);
+      va_end(ap);
+    }
+    toolpath_->Add(Toolpath::kComment);
+    toolpath_->text_.append(text.c_str(), text.size() + 1);
+    if (delegate_) delegate_->Comment("%s", text.c_str());
+  }
+  virtual void SetTemperature(double temperature) {
+    toolpath_->Add(Toolpath::kSetTemperature, temperature);
+    if (delegate_) delegate_->SetTemperature(temperature);
+  }
+  virtual void SetSpeed(double feed_mm_per_sec) {
+    toolpath_->Add(Toolpath::kSetSpeed, feed_mm_per_sec);
+    if (delegate_) delegate_->SetSpeed(feed_mm_per_sec);
+  }
+  virtual void ResetExtrude() {
+    toolpath_->Add(Toolpath::kResetExtrude);
+    if (delegate_) delegate_->ResetExtrude();
+  }
+  virtual void Retract() {
+    toolpath_->Add(Toolpath::kRetract);
+    if (delegate_) delegate_->Retract();
+  }
+  virtual void GoZPos(double z) {
+    toolpath_->Add(Toolpath::kGoZPos, z);
+    if (delegate_) delegate_->GoZPos(z);
+  }
+  virtual void MoveTo(const Vector2D &pos, double z) {
+    toolpath_->Add(Toolpath::kMoveTo, pos.x, pos.y, z);
+    if (delegate_) delegate_->MoveTo(pos, z);
+  }
+  virtual void ExtrudeTo(const Vector2D &pos, double z,
+                         double extrusion_multiplier) {
+    if (z <= toolpath_->max_z_) {
+      toolpath_->Add(Toolpath::kExtrudeTo, pos.x, pos.y, z);
+      toolpath_->AddArray(&extrusion_multiplier, 1);
+    }
+    if (delegate_) delegate_->ExtrudeTo(pos, z, extrusion_multiplier);
+  }
+  virtual void ExtrudePath(const double *x, const double *y, const double *z,
+                           const double *segment_len, int count,
+                           double extrusion_multiplier) {
+    const int recorded = RecordedPoints(z, count);
+    if (recorded > 0) {
+      toolpath_->Add(Toolpath::kExtrudePath, recorded, extrusion_multiplier);
+      AddPoints(x, y, z, segment_len, recorded);
+    }
+    if (delegate_) {
+      delegate_->ExtrudePath(x, y, z, segment_len, count,
+                             extrusion_multiplier);
+    }
+  }
+  virtual void ExtrudeArc(const double *x, const double *y, const double *z,
+                          const double *segment_len, int count,
+                          const Vector2D &center, bool clockwise,
+                          double extrusion_multiplier) {
+    // Leaving out points at the end still leaves an arc.
+    const int recorded = RecordedPoints(z, count);
+    if (recorded > 0) {
+      toolpath_->Add(Toolpath::kExtrudeArc, recorded, extrusion_multiplier);
+      const double arc[3] = { center.x, center.y, (double)clockwise };
+      toolpath_->AddArray(arc, 3);
+      AddPoints(x, y, z, segment_len, recorded);
+    }
+    if (delegate_) {
+      delegate_->ExtrudeArc(x, y, z, segment_len, count, center, clockwise,
+                            extrusion_multiplier);
+    }
+  }
+  virtual void SwitchFan(bool on) {
+    toolpath_->Add(Toolpath::kSwitchFan, on);
+    if (delegate_) delegate_->SwitchFan(on);
+  }
+  virtual double GetExtrusionDistance() {
+    return delegate_ ? delegate_->GetExtrusionDistance() : 0;
+  }
+  virtual double GetPrintTime() {
+    return delegate_ ? delegate_->GetPrintTime() : 0;
+  }
+  virtual int GetFlowLimitedMoves() {
+    return delegate_ ? delegate_->GetFlowLimitedMoves() : 0;
+  }
+  virtual void SetColor(float r, float g, float b) {
+    toolpath_->Add(Toolpath::kSetColor, r, g, b);
+    if (delegate_) delegate_->SetColor(r, g, b);
+  }
+
+  virtual Printer *CreateDetached() const {
+    Printer *detached = NULL;
+    if (delegate_) {
+      detached = delegate_->CreateDetached();
+      if (!detached) return NULL;
+    }
+    return new ToolpathRecorder(detached, new Toolpath(toolpath_->max_z_),
+                                true);
+  }
+  virtual bool SameState(const Printer &detached) const {
+    // The recording itself has no state.
+    const ToolpathRecorder &other
+      = static_cast<const ToolpathRecorder&>(detached);
+    return delegate_ ? delegate_->SameState(*other.delegate_) : true;
+  }
+  virtual void AppendDetached(const Printer &detached) {
+    const ToolpathRecorder &other
+      = static_cast<const ToolpathRecorder&>(detached);
+    toolpath_->Append(*other.toolpath_);
+    if (delegate_) delegate_->AppendDetached(*other.delegate_);
+  }
+
+private:
+  // Number of points at the start of a path that are not above max_z.
+  int RecordedPoints(const double *z, int count) const {
+    int i = 0;
+    while (i < count && z[i] <= toolpath_->max_z_) ++i;
+    return i;
+  }
+
+  void AddPoints(const double *x, const double *y, const double *z,
+                 const double *segment_len, int count) {
+    toolpath_->AddArray(x, count);
+    toolpath_->AddArray(y, count);
+    toolpath_->AddArray(z, count);
+    toolpath_->AddArray(segment_len, count);
+  }
+
+  Printer *const delegate_;
+  Toolpath *const toolpath_;
+  const bool owned_;
+};
+
+Printer *CreateToolpathRecorder(Printer *printer, Toolpath *toolpath) {
+  return new ToolpathRecorder(printer, toolpath, false);
+}
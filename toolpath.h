@@ -0,0 +1,73 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_TOOLPATH_H_
+#define SHELL_EXTRUDE_TOOLPATH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+class Printer;
+
+// The calls made to a Printer, recorded compactly in memory, so that the
+// toolpath created once can be replayed into any number of printers: e.g.
+// GCode and a PostScript preview, or a printer that only counts or
+// estimates.
+//
+// Each record is an op code, its numbers in one arena of doubles and comment
+// text in another. The points of ExtrudePath() and ExtrudeArc() are kept as
+// arrays, that are handed to the printer on replay without copying.
+class Toolpath {
+public:
+  // Extrusions above "max_z" are not recorded, e.g. for a preview that only
+  // needs the first layers. Other calls are always recorded.
+  explicit Toolpath(double max_z);
+
+  // Replay all calls recorded into "printer".
+  void Replay(Printer *printer) const;
+
+  size_t records() const { return ops_.size(); }
+  size_t bytes() const {
+    return ops_.size() + values_.size() * sizeof(double) + text_.size();
+  }
+
+private:
+  friend class ToolpathRecorder;
+
+  enum Op {
+    kPreamble, kInit, kPostamble, kComment, kSetTemperature, kSetSpeed,
+    kResetExtrude, kRetract, kGoZPos, kMoveTo, kExtrudeTo, kExtrudePath,
+    kExtrudeArc, kSwitchFan, kSetColor
+  };
+
+  void Add(Op op) { ops_.push_back(op); }
+  void Add(Op op, double a) { Add(op); values_.push_back(a); }
+  void Add(Op op, double a, double b) { Add(op, a); values_.push_back(b); }
+  void Add(Op op, double a, double b, double c) {
+    Add(op, a, b);
+    values_.push_back(c);
+  }
+  void AddArray(const double *values, int count) {
+    values_.insert(values_.end(), values, values + count);
+  }
+  void Append(const Toolpath &other);
+
+  const double max_z_;
+  std::vector<uint8_t> ops_;
+  std::vector<double> values_;
+  std::string text_;   // Comments, each terminated with '\0'.
+};
+
+// Create a printer that records all calls into "toolpath" (not owned) and
+// passes them on to "printer" (ownership is taken), which answers the
+// queries such as GetPrintTime(). If "printer" is NULL, calls are only
+// recorded and queries answered with 0.
+// Detached printers record into their own toolpath, which is appended to
+// "toolpath" with their output.
+Printer *CreateToolpathRecorder(Printer *printer, Toolpath *toolpath);
+
+#endif  // SHELL_EXTRUDE_TOOLPATH_H_
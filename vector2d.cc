@@ -8,7 +8,21 @@
 Vector2D Centroid(const Polygon &polygon) {
     Vector2D result;
     for (Polygon::size_type i = 0; i < polygon.size(); ++i) {
-        result = result + polygon[i];
+        result = result + FromFixed(polygon[i]);
     }
     return result / polygon.size();
 }
+
+// The total length of distance going through a polygon.
+double CalcPolygonLen(const Polygon &polygon) {
+  double len = 0;
+  const int size = polygon.size();
+  for (int i = 1; i < size; ++i) {
+    len += distance(FromFixed(polygon[i].x - polygon[i-1].x),
+                    FromFixed(polygon[i].y - polygon[i-1].y), 0);
+  }
+  // Back to the beginning.
+  len += distance(FromFixed(polygon[size-1].x - polygon[0].x),
+                  FromFixed(polygon[size-1].y - polygon[0].y), 0);
+  return len;
+}